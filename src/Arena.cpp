@@ -0,0 +1,46 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "Arena.h"
+#include <stdlib.h>
+
+Arena::Arena(size_t blockSize)
+    : mBlockSize(blockSize), mPos(0), mEnd(0), mSize(0)
+{
+}
+
+Arena::~Arena()
+{
+    for (int i=0; i<mBlocks.size(); ++i)
+        free(mBlocks.at(i));
+}
+
+void *Arena::allocateBlock(size_t size, size_t alignment)
+{
+    // big allocations get a block of their own so the rest of the current
+    // block isn't wasted
+    const size_t needed = size + alignment;
+    const bool own = needed > mBlockSize / 4;
+    const size_t blockSize = own ? needed : mBlockSize;
+    char *block = static_cast<char*>(malloc(blockSize));
+    mBlocks.append(block);
+    mSize += blockSize;
+    const uintptr_t pos = (reinterpret_cast<uintptr_t>(block) + alignment - 1) & ~(alignment - 1);
+    if (!own) {
+        mPos = reinterpret_cast<char*>(pos + size);
+        mEnd = block + blockSize;
+    }
+    return reinterpret_cast<void*>(pos);
+}
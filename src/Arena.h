@@ -0,0 +1,177 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef Arena_h
+#define Arena_h
+
+#include <rct/List.h>
+#include <rct/Serializer.h>
+#include <map>
+#include <set>
+#include <new>
+#include <utility>
+#include <stddef.h>
+#include <stdint.h>
+
+// Monotonic allocator for scratch data that is thrown away as a whole.
+// Memory is handed out from large blocks and never given back individually,
+// everything is released when the Arena is destroyed. Not thread safe.
+class Arena
+{
+public:
+    Arena(size_t blockSize = 256 * 1024);
+    ~Arena();
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        const uintptr_t pos = (reinterpret_cast<uintptr_t>(mPos) + alignment - 1) & ~(alignment - 1);
+        if (!mPos || pos + size > reinterpret_cast<uintptr_t>(mEnd))
+            return allocateBlock(size, alignment);
+        mPos = reinterpret_cast<char*>(pos + size);
+        return reinterpret_cast<void*>(pos);
+    }
+
+    // bytes allocated from the system
+    size_t size() const { return mSize; }
+private:
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+    void *allocateBlock(size_t size, size_t alignment);
+
+    const size_t mBlockSize;
+    List<char*> mBlocks;
+    char *mPos, *mEnd;
+    size_t mSize;
+};
+
+// Allocates from an Arena, or from the heap if it doesn't have one.
+// deallocate() is a no-op for arena memory.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    template <typename U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    ArenaAllocator(Arena *arena = 0)
+        : mArena(arena)
+    {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other)
+        : mArena(other.arena())
+    {}
+
+    Arena *arena() const { return mArena; }
+
+    T *allocate(size_t count, const void * = 0)
+    {
+        if (mArena)
+            return static_cast<T*>(mArena->allocate(count * sizeof(T), alignof(T)));
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+    void deallocate(T *t, size_t)
+    {
+        if (!mArena)
+            ::operator delete(t);
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *u, Args&&... args) { ::new (static_cast<void*>(u)) U(std::forward<Args>(args)...); }
+    template <typename U>
+    void destroy(U *u) { u->~U(); }
+
+    size_t max_size() const { return size_t(-1) / sizeof(T); }
+    T *address(T &t) const { return &t; }
+    const T *address(const T &t) const { return &t; }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const { return mArena == other.arena(); }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const { return mArena != other.arena(); }
+private:
+    Arena *mArena;
+};
+
+template <typename T>
+class ArenaSet : public std::set<T, std::less<T>, ArenaAllocator<T> >
+{
+public:
+    typedef std::set<T, std::less<T>, ArenaAllocator<T> > Base;
+    explicit ArenaSet(Arena *arena = 0)
+        : Base(std::less<T>(), ArenaAllocator<T>(arena))
+    {}
+
+    Arena *arena() const { return Base::get_allocator().arena(); }
+    bool contains(const T &t) const { return Base::find(t) != Base::end(); }
+    bool isEmpty() const { return Base::empty(); }
+    int size() const { return Base::size(); }
+};
+
+// Values are constructed with the map's arena so nested containers, e.g.
+// ArenaMap<Location, ArenaSet<Location> >, come from the same arena
+template <typename Key, typename Value>
+class ArenaMap : public std::map<Key, Value, std::less<Key>, ArenaAllocator<std::pair<const Key, Value> > >
+{
+public:
+    typedef std::map<Key, Value, std::less<Key>, ArenaAllocator<std::pair<const Key, Value> > > Base;
+    explicit ArenaMap(Arena *arena = 0)
+        : Base(std::less<Key>(), typename Base::allocator_type(arena))
+    {}
+
+    Arena *arena() const { return Base::get_allocator().arena(); }
+    bool contains(const Key &key) const { return Base::find(key) != Base::end(); }
+    bool isEmpty() const { return Base::empty(); }
+    int size() const { return Base::size(); }
+
+    Value &operator[](const Key &key)
+    {
+        typename Base::iterator it = Base::lower_bound(key);
+        if (it == Base::end() || Base::key_comp()(key, it->first))
+            it = Base::insert(it, typename Base::value_type(key, Value(arena())));
+        return it->second;
+    }
+};
+
+template <typename Key, typename Value>
+inline Serializer &operator<<(Serializer &s, const ArenaMap<Key, Value> &map)
+{
+    s << map.size();
+    for (typename ArenaMap<Key, Value>::const_iterator it = map.begin(); it != map.end(); ++it)
+        s << it->first << it->second;
+    return s;
+}
+
+template <typename Key, typename Value>
+inline Deserializer &operator>>(Deserializer &s, ArenaMap<Key, Value> &map)
+{
+    map.clear();
+    int size;
+    s >> size;
+    for (int i=0; i<size; ++i) {
+        Key key;
+        s >> key;
+        s >> map[key];
+    }
+    return s;
+}
+
+#endif
@@ -69,7 +69,7 @@ String CursorInfo::toString(unsigned cursorInfoFlags, unsigned keyFlags) const
 
     if (!targets.isEmpty() && !(cursorInfoFlags & IgnoreTargets)) {
         ret.append("Targets:\n");
-        for (Set<Location>::const_iterator tit = targets.begin(); tit != targets.end(); ++tit) {
+        for (LocationSet::const_iterator tit = targets.begin(); tit != targets.end(); ++tit) {
             const Location &l = *tit;
             ret.append(String::format<128>("    %s\n", l.key(keyFlags).constData()));
         }
@@ -77,7 +77,7 @@ String CursorInfo::toString(unsigned cursorInfoFlags, unsigned keyFlags) const
 
     if (!references.isEmpty() && !(cursorInfoFlags & IgnoreReferences)) {
         ret.append("References:\n");
-        for (Set<Location>::const_iterator rit = references.begin(); rit != references.end(); ++rit) {
+        for (LocationSet::const_iterator rit = references.begin(); rit != references.end(); ++rit) {
             const Location &l = *rit;
             ret.append(String::format<128>("    %s\n", l.key(keyFlags).constData()));
         }
@@ -111,22 +111,25 @@ int CursorInfo::targetRank(const CursorInfo &target) const
 
 CursorInfo CursorInfo::bestTarget(const SymbolMap &map, const SymbolMap *errors, Location *loc) const
 {
-    const SymbolMap targets = targetInfos(map, errors);
-
-    SymbolMap::const_iterator best = targets.end();
+    // same as picking from targetInfos() but without copying every target
+    const CursorInfo *best = 0;
+    const CursorInfo missing; // targets without a CursorInfo, e.g. inclusion directives
+    Location bestLocation;
     int bestRank = -1;
-    for (SymbolMap::const_iterator it = targets.begin(); it != targets.end(); ++it) {
-        const CursorInfo &ci = it->second;
+    for (LocationSet::const_iterator it = targets.begin(); it != targets.end(); ++it) {
+        const SymbolMap::const_iterator found = RTags::findCursorInfo(map, *it, String(), errors);
+        const CursorInfo &ci = found != map.end() ? found->second : missing;
         const int r = targetRank(ci);
         if (r > bestRank || (r == bestRank && ci.isDefinition())) {
             bestRank = r;
-            best = it;
+            best = &ci;
+            bestLocation = *it;
         }
     }
-    if (best != targets.end()) {
+    if (best) {
         if (loc)
-            *loc = best->first;
-        return best->second;
+            *loc = bestLocation;
+        return *best;
     }
     return CursorInfo();
 }
@@ -134,7 +137,7 @@ CursorInfo CursorInfo::bestTarget(const SymbolMap &map, const SymbolMap *errors,
 SymbolMap CursorInfo::targetInfos(const SymbolMap &map, const SymbolMap *errors) const
 {
     SymbolMap ret;
-    for (Set<Location>::const_iterator it = targets.begin(); it != targets.end(); ++it) {
+    for (LocationSet::const_iterator it = targets.begin(); it != targets.end(); ++it) {
         SymbolMap::const_iterator found = RTags::findCursorInfo(map, *it, String(), errors);
         // ### could/should I pass symbolName as context here?
         if (found != map.end()) {
@@ -151,7 +154,7 @@ SymbolMap CursorInfo::targetInfos(const SymbolMap &map, const SymbolMap *errors)
 SymbolMap CursorInfo::referenceInfos(const SymbolMap &map, const SymbolMap *errors) const
 {
     SymbolMap ret;
-    for (Set<Location>::const_iterator it = references.begin(); it != references.end(); ++it) {
+    for (LocationSet::const_iterator it = references.begin(); it != references.end(); ++it) {
         SymbolMap::const_iterator found = RTags::findCursorInfo(map, *it, String(), errors);
         if (found != map.end()) {
             ret[*it] = found->second;
@@ -165,7 +168,7 @@ SymbolMap CursorInfo::callers(const Location &loc, const SymbolMap &map, const S
     SymbolMap ret;
     const SymbolMap cursors = virtuals(loc, map, errors);
     for (SymbolMap::const_iterator c = cursors.begin(); c != cursors.end(); ++c) {
-        for (Set<Location>::const_iterator it = c->second.references.begin(); it != c->second.references.end(); ++it) {
+        for (LocationSet::const_iterator it = c->second.references.begin(); it != c->second.references.end(); ++it) {
             const SymbolMap::const_iterator found = RTags::findCursorInfo(map, *it, String(), errors);
             if (found == map.end())
                 continue;
@@ -278,6 +281,7 @@ SymbolMap CursorInfo::declarationAndDefinition(const Location &loc, const Symbol
 
 String CursorInfo::displayName() const
 {
+    const String &symbolName = this->symbolName.string();
     switch (kind) {
     case CXCursor_FunctionTemplate:
     case CXCursor_FunctionDecl:
@@ -18,6 +18,8 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <rct/String.h>
 #include "Location.h"
+#include "LocationSet.h"
+#include "SymbolName.h"
 #include <rct/Path.h>
 #include <rct/Log.h>
 #include <rct/List.h>
@@ -66,21 +68,9 @@ public:
     static String kindSpelling(uint16_t kind);
     bool dirty(const Set<uint32_t> &dirty)
     {
-        bool changed = false;
-        Set<Location> *locations[] = { &targets, &references };
-        for (int i=0; i<2; ++i) {
-            Set<Location> &l = *locations[i];
-            Set<Location>::iterator it = l.begin();
-            while (it != l.end()) {
-                if (dirty.contains(it->fileId())) {
-                    changed = true;
-                    l.erase(it++);
-                } else {
-                    ++it;
-                }
-            }
-        }
-        return changed;
+        const auto isDirty = [&dirty](const Location &location) { return dirty.contains(location.fileId()); };
+        const int removed = targets.removeIf(isDirty) + references.removeIf(isDirty);
+        return removed > 0;
     }
 
     String displayName() const;
@@ -120,6 +110,20 @@ public:
         return false;
     }
 
+    // Cursors with the same usr hash are only joined if they agree on kind
+    // and name, a collision between two hashes would otherwise link
+    // unrelated cursors for good. A class may be forward declared as a
+    // struct and the other way around.
+    bool isSameEntity(const CursorInfo &other) const
+    {
+        if (symbolName != other.symbolName)
+            return false;
+        if (kind == other.kind)
+            return true;
+        const auto isRecord = [](uint16_t k) { return k == CXCursor_ClassDecl || k == CXCursor_StructDecl; };
+        return isRecord(kind) && isRecord(other.kind);
+    }
+
     inline bool isDefinition() const
     {
         return kind == CXCursor_EnumConstantDecl || definition;
@@ -133,15 +137,10 @@ public:
     bool unite(const CursorInfo &other)
     {
         bool changed = false;
-        if (targets.isEmpty() && !other.targets.isEmpty()) {
-            targets = other.targets;
+        int count = 0;
+        targets.unite(other.targets, &count);
+        if (count)
             changed = true;
-        } else if (!other.targets.isEmpty()) {
-            int count = 0;
-            targets.unite(other.targets, &count);
-            if (count)
-                changed = true;
-        }
 
         if (end == -1 && start == -1 && other.start != -1 && other.end != -1) {
             start = other.start;
@@ -157,17 +156,9 @@ public:
             symbolName = other.symbolName;
             changed = true;
         }
-        const int oldSize = references.size();
-        if (!oldSize) {
-            references = other.references;
-            if (!references.isEmpty())
-                changed = true;
-        } else {
-            int inserted = 0;
-            references.unite(other.references, &inserted);
-            if (inserted)
-                changed = true;
-        }
+        references.unite(other.references, &count);
+        if (count)
+            changed = true;
 
         return changed;
     }
@@ -179,14 +170,14 @@ public:
     };
     String toString(unsigned cursorInfoFlags = DefaultFlags, unsigned keyFlags = 0) const;
     uint16_t symbolLength; // this is just the symbol name length e.g. foo => 3
-    String symbolName; // this is fully qualified Foobar::Barfoo::foo
+    SymbolName symbolName; // this is fully qualified Foobar::Barfoo::foo
     uint16_t kind;
     CXTypeKind type;
     union {
         bool definition;
         int64_t enumValue; // only used if type == CXCursor_EnumConstantDecl
     };
-    Set<Location> targets, references;
+    LocationSet targets, references;
     int start, end;
 };
 
@@ -18,6 +18,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Server.h"
 #include "CursorInfo.h"
 #include "Project.h"
+#include "SystemIndex.h"
 #include "QueryMessage.h"
 
 CursorInfoJob::CursorInfoJob(const Location &loc, const QueryMessage &query, const std::shared_ptr<Project> &proj)
@@ -30,23 +31,28 @@ void CursorInfoJob::execute()
     const SymbolMap &map = project()->symbols();
     if (map.isEmpty())
         return;
-    SymbolMap::const_iterator it = RTags::findCursorInfo(map, location, context());
+    SymbolMap::const_iterator it = project()->findCursorInfo(location, context());
 
     unsigned ciFlags = 0;
     if (!(queryFlags() & QueryMessage::CursorInfoIncludeTargets))
         ciFlags |= CursorInfo::IgnoreTargets;
     if (!(queryFlags() & QueryMessage::CursorInfoIncludeReferences))
         ciFlags |= CursorInfo::IgnoreReferences;
+    // the parents in a header served by a system index are in its shard
+    const std::shared_ptr<const SystemShard> shard = project()->systemShard(location.fileId());
+    const SymbolMap &parents = shard ? shard->symbols : map;
     if (it != map.end()) {
         write(it->first);
         write(it->second, ciFlags);
+        if (shard)
+            it = parents.find(it->first);
     } else {
-        it = map.lower_bound(location);
-        if (it == map.end())
+        it = parents.lower_bound(location);
+        if (it == parents.end() && !parents.isEmpty())
             --it;
     }
     ciFlags |= CursorInfo::IgnoreTargets|CursorInfo::IgnoreReferences;
-    if (it != map.begin() && queryFlags() & QueryMessage::CursorInfoIncludeParents) {
+    if (it != parents.end() && it != parents.begin() && queryFlags() & QueryMessage::CursorInfoIncludeParents) {
         const uint32_t fileId = location.fileId();
         const int offset = location.offset();
         while (true) {
@@ -58,7 +64,7 @@ void CursorInfoJob::execute()
                 write(it->first);
                 write(it->second, ciFlags);
             }
-            if (it == map.begin())
+            if (it == parents.begin())
                 break;
         }
     }
@@ -0,0 +1,308 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "DataFile.h"
+#include <rct/Log.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+    SectionMagic = 0x63737472, // "rtsc"
+    FileHeaderSize = sizeof(int) + sizeof(uint64_t) * 2,
+    SectionHeaderSize = sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2,
+    TableEntrySize = sizeof(uint64_t) * 3 + sizeof(uint32_t)
+};
+
+// Adler-32, run over each section once
+static uint32_t checksum(const char *data, uint64_t size)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+    uint32_t a = 1, b = 0;
+    while (size) {
+        uint64_t chunk = size < 5552 ? size : 5552;
+        size -= chunk;
+        while (chunk--) {
+            a += *bytes++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+template <typename T>
+static inline T readValue(const char *&data)
+{
+    T t;
+    memcpy(&t, data, sizeof(T));
+    data += sizeof(T);
+    return t;
+}
+
+template <typename T>
+static inline void appendValue(String &out, const T &t)
+{
+    out.append(reinterpret_cast<const char*>(&t), sizeof(T));
+}
+
+DataFile::DataFile(const Path &path)
+    : mPath(path), mVersion(-1), mData(0), mSize(0), mRecovered(false)
+{
+}
+
+DataFile::~DataFile()
+{
+    close();
+}
+
+bool DataFile::open(int expectedVersion)
+{
+    close();
+    const int fd = ::open(mPath.constData(), O_RDONLY);
+    if (fd == -1) {
+        mError = String::format<128>("Can't open %s", mPath.constData());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<uint64_t>(st.st_size) < FileHeaderSize) {
+        mError = String::format<128>("Can't stat %s", mPath.constData());
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        mError = String::format<128>("Can't mmap %s", mPath.constData());
+        return false;
+    }
+    mData = static_cast<char*>(data);
+    mSize = st.st_size;
+
+    const char *header = mData;
+    mVersion = readValue<int>(header);
+    if (mVersion != expectedVersion) {
+        mError = String::format<128>("Wrong database version. Expected %d, got %d for %s",
+                                     expectedVersion, mVersion, mPath.constData());
+        close();
+        return false;
+    }
+    const uint64_t fileSize = readValue<uint64_t>(header);
+    const uint64_t tableOffset = readValue<uint64_t>(header);
+    if (fileSize == mSize && readTable(tableOffset))
+        return true;
+
+    recover();
+    if (mSections.isEmpty()) {
+        mError = String::format<128>("%s seems to be corrupted", mPath.constData());
+        close();
+        return false;
+    }
+    error("%s seems to be truncated or corrupted, recovered %d sections, %d damaged",
+          mPath.constData(), static_cast<int>(mSections.size()), static_cast<int>(mDamaged.size()));
+    return true;
+}
+
+bool DataFile::readTable(uint64_t tableOffset)
+{
+    if (tableOffset < FileHeaderSize || tableOffset > mSize || mSize - tableOffset < sizeof(int) + sizeof(uint32_t))
+        return false;
+    const char *table = mData + tableOffset;
+    const int count = readValue<int>(table);
+    const uint64_t tableSize = sizeof(int) + static_cast<uint64_t>(count) * TableEntrySize;
+    if (count < 0 || tableSize + sizeof(uint32_t) != mSize - tableOffset)
+        return false;
+    const char *end = mData + tableOffset + tableSize;
+    if (checksum(mData + tableOffset, tableSize) != readValue<uint32_t>(end))
+        return false;
+    for (int i=0; i<count; ++i) {
+        const uint64_t id = readValue<uint64_t>(table);
+        Section &section = mSections[id];
+        section.offset = readValue<uint64_t>(table);
+        section.size = readValue<uint64_t>(table);
+        section.checksum = readValue<uint32_t>(table);
+        if (section.offset > tableOffset || section.size > tableOffset - section.offset) {
+            mSections.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+void DataFile::recover()
+{
+    mSections.clear();
+    mRecovered = true;
+    uint64_t pos = FileHeaderSize;
+    while (mSize - pos >= SectionHeaderSize) {
+        const char *header = mData + pos;
+        if (readValue<uint32_t>(header) != SectionMagic)
+            break;
+        const uint32_t sum = readValue<uint32_t>(header);
+        const uint64_t id = readValue<uint64_t>(header);
+        const uint64_t size = readValue<uint64_t>(header);
+        const uint64_t offset = pos + SectionHeaderSize;
+        if (size > mSize - offset)
+            break; // torn write
+        if (checksum(mData + offset, size) == sum) {
+            Section &section = mSections[id];
+            section.offset = offset;
+            section.size = size;
+            section.checksum = sum;
+            section.state = Verified;
+        } else {
+            mDamaged.append(id);
+        }
+        pos = offset + size;
+    }
+}
+
+void DataFile::close()
+{
+    if (mData) {
+        munmap(mData, mSize);
+        mData = 0;
+        mSize = 0;
+    }
+    mRecovered = false;
+    mSections.clear();
+    mDamaged.clear();
+}
+
+const char *DataFile::section(uint64_t id, uint64_t *size, uint32_t *sum) const
+{
+    const Hash<uint64_t, Section>::const_iterator it = mSections.find(id);
+    if (!mData || it == mSections.end())
+        return 0;
+    const char *data = mData + it->second.offset;
+    switch (it->second.state.load(std::memory_order_acquire)) {
+    case Unverified:
+        // two threads may both verify it, they come to the same conclusion
+        if (checksum(data, it->second.size) != it->second.checksum) {
+            error("Section 0x%llx in %s failed its checksum",
+                  static_cast<unsigned long long>(id), mPath.constData());
+            it->second.state.store(Damaged, std::memory_order_release);
+            return 0;
+        }
+        it->second.state.store(Verified, std::memory_order_release);
+        break;
+    case Damaged:
+        return 0;
+    }
+    *size = it->second.size;
+    if (sum)
+        *sum = it->second.checksum;
+    return data;
+}
+
+DataFileWriter::DataFileWriter(const Path &path)
+    : mPath(path), mTempPath(path + ".tmp"), mFile(0), mVersion(0)
+{
+}
+
+DataFileWriter::~DataFileWriter()
+{
+    if (mFile) {
+        fclose(mFile);
+        Path::rm(mTempPath);
+    }
+}
+
+bool DataFileWriter::open(int version)
+{
+    assert(!mFile);
+    mFile = fopen(mTempPath.constData(), "w");
+    if (!mFile) {
+        error("Can't open file %s", mTempPath.constData());
+        return false;
+    }
+    mVersion = version;
+    String header;
+    appendValue(header, mVersion);
+    appendValue(header, static_cast<uint64_t>(0));
+    appendValue(header, static_cast<uint64_t>(0));
+    fwrite(header.constData(), header.size(), 1, mFile);
+    return true;
+}
+
+void DataFileWriter::writeSection(uint64_t id, const char *data, uint64_t size, uint32_t sum)
+{
+    assert(mFile);
+    String header;
+    appendValue(header, static_cast<uint32_t>(SectionMagic));
+    appendValue(header, sum);
+    appendValue(header, id);
+    appendValue(header, size);
+    const Section section = { id, static_cast<uint64_t>(ftello(mFile)) + header.size(), size, sum };
+    if (fwrite(header.constData(), header.size(), 1, mFile) != 1 || (size && fwrite(data, size, 1, mFile) != 1)) {
+        error("Failed to write section 0x%llx to %s", static_cast<unsigned long long>(id), mTempPath.constData());
+        return;
+    }
+    mSections.append(section);
+}
+
+void DataFileWriter::writeRaw(uint64_t id, const char *data, uint64_t size)
+{
+    writeSection(id, data, size, checksum(data, size));
+}
+
+bool DataFileWriter::copySection(const DataFile &from, uint64_t id)
+{
+    uint64_t size;
+    uint32_t sum;
+    const char *data = from.section(id, &size, &sum);
+    if (!data)
+        return false;
+    writeSection(id, data, size, sum);
+    return true;
+}
+
+bool DataFileWriter::commit()
+{
+    assert(mFile);
+    const uint64_t tableOffset = ftello(mFile);
+    String table;
+    appendValue(table, static_cast<int>(mSections.size()));
+    for (int i=0; i<mSections.size(); ++i) {
+        const Section &section = mSections.at(i);
+        appendValue(table, section.id);
+        appendValue(table, section.offset);
+        appendValue(table, section.size);
+        appendValue(table, section.checksum);
+    }
+    appendValue(table, checksum(table.constData(), table.size()));
+    fwrite(table.constData(), table.size(), 1, mFile);
+
+    const uint64_t fileSize = ftello(mFile);
+    String header;
+    appendValue(header, mVersion);
+    appendValue(header, fileSize);
+    appendValue(header, tableOffset);
+    fseek(mFile, 0, SEEK_SET);
+    fwrite(header.constData(), header.size(), 1, mFile);
+    const bool ok = !ferror(mFile);
+    fclose(mFile);
+    mFile = 0;
+    if (!ok || rename(mTempPath.constData(), mPath.constData())) {
+        error("Failed to write %s", mPath.constData());
+        Path::rm(mTempPath);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,143 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef DataFile_h
+#define DataFile_h
+
+#include <rct/Hash.h>
+#include <rct/List.h>
+#include <rct/Path.h>
+#include <rct/Serializer.h>
+#include <rct/String.h>
+#include <stdio.h>
+#include <atomic>
+
+// On-disk layout:
+//
+// int version
+// uint64_t fileSize
+// uint64_t tableOffset
+// sectionCount * { uint32_t magic, uint32_t checksum, uint64_t id, uint64_t size, char data[size] }
+// int sectionCount (at tableOffset)
+// sectionCount * { uint64_t id, uint64_t offset, uint64_t size, uint32_t checksum }
+// uint32_t tableChecksum
+//
+// The file is mmap'ed read-only so individual sections can be deserialized
+// on demand without touching the rest of the file. The table is written
+// last so the number of sections doesn't have to be known up front.
+//
+// Every section is checksummed and verified the first time it's read, the
+// result is remembered since the mapping doesn't change. If the table
+// is missing or damaged, e.g. because the file was truncated, the sections
+// are recovered by walking their headers from the start of the file.
+
+class DataFile
+{
+public:
+    DataFile(const Path &path);
+    ~DataFile();
+
+    bool open(int expectedVersion);
+    void close();
+    bool isOpen() const { return mData; }
+
+    Path path() const { return mPath; }
+    int version() const { return mVersion; }
+    const String &errorString() const { return mError; }
+
+    // true if the table was damaged and the sections had to be recovered,
+    // damagedSections() are the ones that failed their checksum
+    bool isRecovered() const { return mRecovered; }
+    const List<uint64_t> &damagedSections() const { return mDamaged; }
+
+    bool hasSection(uint64_t id) const { return mSections.contains(id); }
+    List<uint64_t> sections() const { return mSections.keys(); }
+    // returns 0 if the section doesn't exist or fails its checksum
+    const char *section(uint64_t id, uint64_t *size, uint32_t *checksum = 0) const;
+
+    template <typename T>
+    bool read(uint64_t id, T &t) const
+    {
+        uint64_t size;
+        const char *data = section(id, &size);
+        if (!data)
+            return false;
+        Deserializer in(data, static_cast<int>(size));
+        in >> t;
+        return true;
+    }
+private:
+    bool readTable(uint64_t tableOffset);
+    void recover();
+
+    enum State {
+        Unverified,
+        Verified,
+        Damaged
+    };
+    struct Section {
+        Section() : offset(0), size(0), checksum(0), state(Unverified) {}
+        uint64_t offset, size;
+        uint32_t checksum;
+        // sections are read from several threads
+        mutable std::atomic<int> state;
+    };
+
+    const Path mPath;
+    int mVersion;
+    char *mData;
+    uint64_t mSize;
+    bool mRecovered;
+    String mError;
+    Hash<uint64_t, Section> mSections;
+    List<uint64_t> mDamaged;
+};
+
+class DataFileWriter
+{
+public:
+    DataFileWriter(const Path &path);
+    ~DataFileWriter();
+
+    bool open(int version);
+    template <typename T>
+    void write(uint64_t id, const T &t)
+    {
+        String data;
+        {
+            Serializer out(data);
+            out << t;
+        }
+        writeRaw(id, data.constData(), data.size());
+    }
+    void writeRaw(uint64_t id, const char *data, uint64_t size);
+    // copies a section, returns false if it failed its checksum
+    bool copySection(const DataFile &from, uint64_t id);
+    bool commit();
+private:
+    void writeSection(uint64_t id, const char *data, uint64_t size, uint32_t checksum);
+
+    struct Section {
+        uint64_t id, offset, size;
+        uint32_t checksum;
+    };
+
+    const Path mPath, mTempPath;
+    FILE *mFile;
+    int mVersion;
+    List<Section> mSections;
+};
+
+#endif
@@ -0,0 +1,142 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "FileCache.h"
+#include <rct/Hash.h>
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+
+enum {
+    MaxCacheSize = 64 * 1024 * 1024
+};
+
+bool FileContents::convertOffset(uint32_t offset, int &line, int &col) const
+{
+    const uint32_t size = mContents.size();
+    if (offset > size || (offset == size && (!size || mContents.at(size - 1) == '\n'))) {
+        line = col = -1;
+        return false;
+    }
+    const int idx = lineIndex(offset);
+    line = idx + 1;
+    col = offset - mLines.at(idx) + 1;
+    return true;
+}
+
+String FileContents::context(uint32_t offset, int *column) const
+{
+    if (offset >= static_cast<uint32_t>(mContents.size()))
+        return String();
+    const uint32_t start = mLines.at(lineIndex(offset));
+    const char *data = mContents.constData() + start;
+    const char *end = static_cast<const char*>(memchr(data, '\n', mContents.size() - start));
+    const int length = std::min<int>(end ? end - data : mContents.size() - start, 1023);
+    if (column)
+        *column = offset - start;
+    return String(data, length);
+}
+
+int FileContents::lineIndex(uint32_t offset) const
+{
+    std::call_once(mLinesOnce, [this]() {
+            mLines.append(0);
+            const char *data = mContents.constData();
+            const int size = mContents.size();
+            for (int i=0; i<size; ++i) {
+                if (data[i] == '\n')
+                    mLines.append(i + 1);
+            }
+        });
+    return std::upper_bound(mLines.begin(), mLines.end(), offset) - mLines.begin() - 1;
+}
+
+struct CacheEntry
+{
+    CacheEntry()
+        : size(0), lastUsed(0)
+    {}
+
+    std::shared_ptr<const FileContents> contents;
+    off_t size;
+    uint64_t lastUsed;
+};
+
+static std::mutex sMutex;
+static Hash<Path, CacheEntry> sEntries;
+static uint64_t sSize = 0, sCounter = 0;
+
+static inline void evict() // sMutex always held
+{
+    // drop the oldest quarter so this doesn't happen for every file
+    List<std::pair<uint64_t, Path> > entries;
+    for (Hash<Path, CacheEntry>::const_iterator it = sEntries.begin(); it != sEntries.end(); ++it)
+        entries.append(std::make_pair(it->second.lastUsed, it->first));
+    std::sort(entries.begin(), entries.end());
+    for (int i=0; i<entries.size() && sSize > MaxCacheSize * 3 / 4; ++i) {
+        const Hash<Path, CacheEntry>::iterator it = sEntries.find(entries.at(i).second);
+        sSize -= it->second.size;
+        sEntries.erase(it);
+    }
+}
+
+std::shared_ptr<const FileContents> FileCache::contents(const Path &path)
+{
+    struct stat st;
+    if (stat(path.constData(), &st) || !S_ISREG(st.st_mode))
+        return std::shared_ptr<const FileContents>();
+    {
+        std::lock_guard<std::mutex> lock(sMutex);
+        const Hash<Path, CacheEntry>::iterator it = sEntries.find(path);
+        if (it != sEntries.end()) {
+            if (it->second.size == st.st_size && it->second.contents->modified() == st.st_mtime) {
+                it->second.lastUsed = ++sCounter;
+                return it->second.contents;
+            }
+            sSize -= it->second.size;
+            sEntries.erase(it);
+        }
+    }
+
+    // read without the lock, a file read twice at the same time is cheaper
+    // than making everyone wait
+    const String data = st.st_size ? path.readAll() : String();
+    if (data.isEmpty() && st.st_size)
+        return std::shared_ptr<const FileContents>();
+    const std::shared_ptr<const FileContents> contents(new FileContents(data, st.st_mtime));
+    if (data.size() != st.st_size || data.size() > MaxCacheSize / 4)
+        return contents; // changed while we were reading or too big to keep
+
+    std::lock_guard<std::mutex> lock(sMutex);
+    CacheEntry &entry = sEntries[path];
+    sSize -= entry.size; // someone else may have read it in the meantime
+    entry.contents = contents;
+    entry.size = st.st_size;
+    entry.lastUsed = ++sCounter;
+    sSize += entry.size;
+    if (sSize > MaxCacheSize)
+        evict();
+    return contents;
+}
+
+void FileCache::invalidate(const Path &path)
+{
+    std::lock_guard<std::mutex> lock(sMutex);
+    const Hash<Path, CacheEntry>::iterator it = sEntries.find(path);
+    if (it != sEntries.end()) {
+        sSize -= it->second.size;
+        sEntries.erase(it);
+    }
+}
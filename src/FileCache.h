@@ -0,0 +1,65 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef FileCache_h
+#define FileCache_h
+
+#include <rct/List.h>
+#include <rct/Path.h>
+#include <rct/String.h>
+#include <memory>
+#include <mutex>
+#include <time.h>
+
+// The contents of a source file as it was when it was read
+class FileContents
+{
+public:
+    FileContents(const String &contents, time_t modified)
+        : mContents(contents), mModified(modified)
+    {}
+
+    const String &contents() const { return mContents; }
+    time_t modified() const { return mModified; }
+
+    // 1-based line and column of offset, false if it's past the end
+    bool convertOffset(uint32_t offset, int &line, int &col) const;
+    // the line offset is on without the newline, column is set to the
+    // 0-based column of offset
+    String context(uint32_t offset, int *column) const;
+private:
+    int lineIndex(uint32_t offset) const;
+
+    const String mContents;
+    const time_t mModified;
+    // start of each line, computed the first time it's needed
+    mutable std::once_flag mLinesOnce;
+    mutable List<uint32_t> mLines;
+};
+
+// Process wide cache of file contents for the code that keeps going back
+// to the same files, the indexers and the context and line numbers in
+// query output. Entries are dropped when the watchers report a change or
+// when the file's size or modification time no longer match, and the least
+// recently used ones are dropped when the cache gets too big.
+class FileCache
+{
+public:
+    // null if the file can't be read
+    static std::shared_ptr<const FileContents> contents(const Path &path);
+    static void invalidate(const Path &path);
+};
+
+#endif
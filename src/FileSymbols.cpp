@@ -0,0 +1,94 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "FileSymbols.h"
+#include "RTagsClang.h"
+#include <algorithm>
+#include <assert.h>
+
+FileSymbols::FileSymbols(const SymbolMap &map, uint32_t fileId)
+    : mFileId(fileId)
+{
+    const SymbolMap::const_iterator end = map.upper_bound(Location(fileId, UINT32_MAX));
+    for (SymbolMap::const_iterator it = map.lower_bound(Location(fileId, 0)); it != end; ++it) {
+        const Entry entry = {
+            it, it->second.start, it->second.end, it->second.symbolLength,
+            it->second.isDefinition() && RTags::isContainer(it->second.kind)
+        };
+        mOffsets.append(it->first.offset());
+        mEntries.append(entry);
+    }
+}
+
+int FileSymbols::lowerBound(uint32_t offset) const
+{
+    return std::lower_bound(mOffsets.begin(), mOffsets.end(), offset) - mOffsets.begin();
+}
+
+int FileSymbols::indexOf(uint32_t offset) const
+{
+    const int idx = lowerBound(offset);
+    return idx < mOffsets.size() && mOffsets.at(idx) == offset ? idx : -1;
+}
+
+SymbolMap::const_iterator FileSymbols::find(const Location &location, const String &context, bool scan,
+                                            const SymbolMap::const_iterator &end) const
+{
+    assert(location.fileId() == mFileId);
+    const uint32_t offset = location.offset();
+    const int count = mOffsets.size();
+    const int idx = lowerBound(offset);
+    if (context.isEmpty() || !scan) {
+        if (idx < count && mOffsets.at(idx) == offset)
+            return mEntries.at(idx).cursor;
+        if (idx > 0) {
+            const Entry &entry = mEntries.at(idx - 1);
+            const int off = offset - mOffsets.at(idx - 1);
+            if (entry.symbolLength > off && (context.isEmpty() || entry.cursor->second.symbolName.contains(context)))
+                return entry.cursor;
+        }
+        return end;
+    }
+
+    int f = idx;
+    if (f > 0 && (f == count || mOffsets.at(f) != offset))
+        --f;
+    int b = f;
+    enum { Search = 32 };
+    for (int j=0; j<Search && (f < count || b > 0); ++j) {
+        if (f < count) {
+            if (mEntries.at(f).cursor->second.symbolName.contains(context))
+                return mEntries.at(f).cursor;
+            ++f;
+        }
+        if (b > 0) {
+            --b;
+            if (mEntries.at(b).cursor->second.symbolName.contains(context))
+                return mEntries.at(b).cursor;
+        }
+    }
+    return end;
+}
+
+SymbolMap::const_iterator FileSymbols::container(int idx, uint32_t offset, const SymbolMap::const_iterator &end) const
+{
+    const int off = offset;
+    while (--idx >= 0) {
+        const Entry &entry = mEntries.at(idx);
+        if (entry.container && off >= entry.start && off <= entry.end)
+            return entry.cursor;
+    }
+    return end;
+}
@@ -0,0 +1,65 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef FileSymbols_h
+#define FileSymbols_h
+
+#include "CursorInfo.h"
+#include <rct/List.h>
+#include <rct/String.h>
+
+// A flat view of the symbols of one file in a SymbolMap. The offsets are
+// kept in one sorted array and the parts of the cursors that lookups look
+// at in another, so finding a cursor is a binary search over contiguous
+// memory rather than a walk down the tree.
+//
+// The entries point into the SymbolMap, a FileSymbols is only valid until
+// the map changes.
+class FileSymbols
+{
+public:
+    FileSymbols(const SymbolMap &map, uint32_t fileId);
+
+    uint32_t fileId() const { return mFileId; }
+    int count() const { return mOffsets.size(); }
+    bool isEmpty() const { return mOffsets.isEmpty(); }
+
+    // index of the cursor at offset or -1
+    int indexOf(uint32_t offset) const;
+    SymbolMap::const_iterator cursor(int idx) const { return mEntries.at(idx).cursor; }
+
+    // same as RTags::findCursorInfo() restricted to this file, returns end
+    // if nothing matches
+    SymbolMap::const_iterator find(const Location &location, const String &context, bool scan,
+                                   const SymbolMap::const_iterator &end) const;
+    // the innermost function/class definition before idx that contains
+    // offset
+    SymbolMap::const_iterator container(int idx, uint32_t offset, const SymbolMap::const_iterator &end) const;
+private:
+    int lowerBound(uint32_t offset) const;
+
+    struct Entry {
+        SymbolMap::const_iterator cursor;
+        int start, end;
+        uint16_t symbolLength;
+        bool container;
+    };
+
+    const uint32_t mFileId;
+    List<uint32_t> mOffsets;
+    List<Entry> mEntries;
+};
+
+#endif
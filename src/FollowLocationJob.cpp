@@ -18,6 +18,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Server.h"
 #include "CursorInfo.h"
 #include "Project.h"
+#include "SystemIndex.h"
 
 FollowLocationJob::FollowLocationJob(const Location &loc, const QueryMessage &query, const std::shared_ptr<Project> &project)
     : Job(query, 0, project), location(loc)
@@ -33,11 +34,16 @@ void FollowLocationJob::execute()
     const SymbolMap *errors = e == errorSymbols.end() ? 0 : &e->second;
 
     bool foundInError = false;
-    SymbolMap::const_iterator it = RTags::findCursorInfo(map, location, context(), errors, &foundInError);
+    SymbolMap::const_iterator it = project()->findCursorInfo(location, context(), errors, &foundInError);
 
     if (it == map.end())
         return;
 
+    // targets inside a header served by a system index are in its shard
+    const std::shared_ptr<const SystemShard> shard = errors ? std::shared_ptr<const SystemShard>() : project()->systemShard(location.fileId());
+    if (shard)
+        errors = &shard->symbols;
+
     const CursorInfo &cursorInfo = it->second;
     if (cursorInfo.isClass() && cursorInfo.isDefinition()) {
         return;
@@ -16,10 +16,12 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "IndexerJob.h"
 #include <rct/StopWatch.h>
 #include "Project.h"
+#include "Server.h"
+#include "SystemIndex.h"
 
 IndexerJob::IndexerJob(const std::shared_ptr<Project> &project, Type type, const SourceInformation &sourceInformation)
     : Job(0, project), mType(type), mLogFile(0), mSourceInformation(sourceInformation),
-      mParseTime(0), mStarted(false)
+      mSystemIndex(Server::instance()->systemIndex(sourceInformation)), mParseTime(0), mStarted(false)
 {}
 
 IndexerJob::IndexerJob(const QueryMessage &msg, const std::shared_ptr<Project> &project,
@@ -33,14 +35,19 @@ IndexerJob::~IndexerJob()
 {
 }
 
-Location IndexerJob::createLocation(const Path &file, uint32_t offset, bool *blocked)
+uint32_t IndexerJob::insertFile(const Path &file)
 {
     uint32_t &fileId = mFileIds[file];
     if (!fileId) {
         const Path resolved = file.resolved();
         fileId = mFileIds[resolved] = Location::insertFile(resolved);
     }
-    return createLocation(fileId, offset, blocked);
+    return fileId;
+}
+
+Location IndexerJob::createLocation(const Path &file, uint32_t offset, bool *blocked)
+{
+    return createLocation(insertFile(file), offset, blocked);
 }
 
 
@@ -60,12 +67,23 @@ Location IndexerJob::createLocation(uint32_t fileId, uint32_t offset, bool *bloc
             if (!p) {
                 return Location();
             } else if (p->visitFile(fileId)) {
+                if (mSystemIndex && mSystemIndex->contains(fileId)) {
+                    // another project built the same way already did this one
+                    if (mLogFile)
+                        fprintf(mLogFile, "SHARED %s\n", Location::path(fileId).constData());
+                    mData->sharedFiles.insert(fileId);
+                    mBlockedFiles.insert(fileId);
+                    *blocked = true;
+                    return Location();
+                }
                 if (blocked)
                     *blocked = false;
                 if (mLogFile)
                     fprintf(mLogFile, "WON %s\n", Location::path(fileId).constData());
                 mVisitedFiles.insert(fileId);
                 mData->errors[fileId] = 0;
+                if (mSystemIndex && Location::path(fileId).isSystem())
+                    mData->systemFiles.insert(fileId);
             } else {
                 if (mLogFile)
                     fprintf(mLogFile, "LOST %s\n", Location::path(fileId).constData());
@@ -96,6 +114,7 @@ void IndexerJob::execute()
     mTimer.restart();
     mData = createIndexData();
     assert(mData);
+    mData->systemIndex = mSystemIndex;
 
     index();
     IndexerJob::SharedPtr that = std::static_pointer_cast<IndexerJob>(shared_from_this());
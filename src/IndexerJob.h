@@ -17,11 +17,31 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #define IndexerJob_h
 
 #include "RTags.h"
+#include "Arena.h"
 #include "Job.h"
 #include <rct/Hash.h>
 #include <rct/ThreadPool.h>
 #include <rct/StopWatch.h>
 
+// The references and usrs of a job are only read when they're merged into
+// the project so they're allocated from the job's arena and released in one
+// go with the IndexData
+typedef ArenaMap<Location, ArenaSet<Location> > IndexReferenceMap;
+typedef ArenaMap<uint64_t, ArenaSet<Location> > IndexUsrMap;
+
+inline Serializer &operator<<(Serializer &s, const ArenaSet<Location> &locations)
+{
+    writeLocations(s, locations);
+    return s;
+}
+
+inline Deserializer &operator>>(Deserializer &s, ArenaSet<Location> &locations)
+{
+    readLocations(s, locations);
+    return s;
+}
+
+class SystemIndex;
 class IndexData
 {
 public:
@@ -29,19 +49,24 @@ public:
         ClangType = 1
     };
     IndexData(int t = 0)
-        : type(t)
+        : references(&arena), usrMap(&arena), type(t)
     {}
     virtual ~IndexData()
     {}
 
-    ReferenceMap references;
+    Arena arena;
+    IndexReferenceMap references;
     SymbolMap symbols;
     SymbolNameMap symbolNames;
     DependencyMap dependencies;
     String message;
-    UsrMap usrMap;
+    IndexUsrMap usrMap;
     FixItMap fixIts;
     Hash<uint32_t, int> errors;
+    // systemFiles were visited by this job and can be published to the
+    // system index, sharedFiles were already in it and are served from there
+    std::shared_ptr<SystemIndex> systemIndex;
+    Set<uint32_t> systemFiles, sharedFiles;
     const int type;
 };
 
@@ -74,6 +99,8 @@ protected:
 
     Location createLocation(uint32_t fileId, uint32_t offset, bool *blocked);
     Location createLocation(const Path &file, uint32_t offset, bool *blocked);
+    // fileId of the resolved path, only hits the file system once per path
+    uint32_t insertFile(const Path &file);
     const Type mType;
 
     FILE *mLogFile;
@@ -83,6 +110,7 @@ protected:
     Hash<String, uint32_t> mFileIds;
 
     SourceInformation mSourceInformation;
+    std::shared_ptr<SystemIndex> mSystemIndex;
 
     StopWatch mTimer;
     std::shared_ptr<IndexData> mData;
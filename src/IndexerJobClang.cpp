@@ -17,6 +17,8 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Project.h"
 #include "Server.h"
 #include "CompilerManager.h"
+#include "FileCache.h"
+#include "SymbolNameIndex.h"
 
 #include "RTagsPlugin.h"
 
@@ -95,7 +97,7 @@ void IndexerJobClang::inclusionVisitor(CXFile includedFile,
                                        CXClientData userData)
 {
     IndexerJobClang *job = static_cast<IndexerJobClang*>(userData);
-    const Location l(includedFile, 0);
+    const Location l(includedFile ? job->resolveFile(includedFile) : 0, 0);
 
     const Path path = l.path();
     job->mData->symbolNames[path].insert(l);
@@ -109,8 +111,7 @@ void IndexerJobClang::inclusionVisitor(CXFile includedFile,
         for (unsigned i=0; i<includeLen; ++i) {
             CXFile originatingFile;
             clang_getSpellingLocation(includeStack[i], &originatingFile, 0, 0, 0);
-            Location loc(originatingFile, 0);
-            const uint32_t f = loc.fileId();
+            const uint32_t f = originatingFile ? job->resolveFile(originatingFile) : 0;
             if (f)
                 job->mData->dependencies[fileId].insert(f);
         }
@@ -185,34 +186,12 @@ String IndexerJobClang::addNamePermutations(const CXCursor &cursor, const Locati
     String ret;
     // i == 0 --> with templates, i == 1 without templates or without EnumConstantDecl part
     for (int i=0; i<2; ++i) {
-        {
-            char *ch = buf + pos;
-            while (true) {
-                const String name(ch, sizeof(buf) - (ch - buf) - 1);
-                mData->symbolNames[name].insert(location);
-                if (!type.isEmpty() && (originalKind != CXCursor_ParmDecl || !strchr(ch, '('))) {
-                    // We only want to add the type to the final declaration for ParmDecls
-                    // e.g.
-                    // void foo(int)::bar
-                    // int bar
-                    //
-                    // not
-                    // int void foo(int)::bar
-                    // or
-                    // void foo(int)::int bar
-
-                    mData->symbolNames[type + name].insert(location);
-                }
-
-                ch = strstr(ch + 1, "::");
-
-                if (ch) {
-                    ch += 2;
-                } else {
-                    break;
-                }
-            }
-        }
+        // only the fully qualified name is stored, SymbolNameIndex generates
+        // the shorter ones when the project is queried. ParmDecls only get
+        // the type on the names that aren't qualified by the function, e.g.
+        // "int bar" but not "int void foo(int)::bar"
+        mData->symbolNames[SymbolNameIndex::key(type, buf + pos, sizeof(buf) - pos - 1,
+                                                originalKind == CXCursor_ParmDecl)].insert(location);
         if (i == 0) {
             // create actual symbol name that will go into CursorInfo. This doesn't include namespaces etc
             ret.assign(buf + cutoff, sizeof(buf) - cutoff - 1);
@@ -323,6 +302,33 @@ struct LastCursorUpdater
     const CXCursor &mCursor;
 };
 
+int IndexerJobClang::abortQuery(CXClientData userData, void *)
+{
+    IndexerJobClang *job = static_cast<IndexerJobClang*>(userData);
+    std::lock_guard<std::mutex> lock(job->mutex());
+    return job->aborted();
+}
+
+// With a session the first job to include a file has to be the one that
+// claims it, it's the only one that is sure to have parsed its bodies. The
+// claim is taken here rather than when the cursors are visited.
+CXIdxClientFile IndexerJobClang::enteredMainFile(CXClientData userData, CXFile file, void *)
+{
+    IndexerJobClang *job = static_cast<IndexerJobClang*>(userData);
+    bool blocked;
+    job->createLocation(job->resolveFile(file), 0, &blocked);
+    return 0;
+}
+
+CXIdxClientFile IndexerJobClang::includedFile(CXClientData userData, const CXIdxIncludedFileInfo *info)
+{
+    IndexerJobClang *job = static_cast<IndexerJobClang*>(userData);
+    bool blocked;
+    if (info->file)
+        job->createLocation(job->resolveFile(info->file), 0, &blocked);
+    return 0;
+}
+
 CXChildVisitResult IndexerJobClang::indexVisitor(CXCursor cursor, CXCursor parent, CXClientData data)
 {
     IndexerJobClang *job = static_cast<IndexerJobClang*>(data);
@@ -424,24 +430,23 @@ void IndexerJobClang::superclassTemplateMemberFunctionUgleHack(const CXCursor &c
         if (templateRef == CXCursor_TemplateRef) {
             const CXCursor classTemplate = clang_getCursorReferenced(templateRef);
             if (classTemplate == CXCursor_ClassTemplate) {
-                FILE *f = fopen(location.path().constData(), "r");
-                if (f) {
+                const std::shared_ptr<const FileContents> contents = FileCache::contents(location.path());
+                if (contents) {
                     const CXSourceRange range = clang_getCursorExtent(cursor);
                     const CXSourceLocation end = clang_getRangeEnd(range);
                     unsigned offset;
                     clang_getSpellingLocation(end, 0, 0, 0, &offset);
 
+                    const String &data = contents->contents();
                     String name;
-                    while (offset > 0) {
-                        fseek(f, --offset, SEEK_SET);
-                        char ch = static_cast<char>(fgetc(f));
+                    while (offset > 0 && --offset < static_cast<unsigned>(data.size())) {
+                        const char ch = data.at(offset);
                         if (isalnum(ch) || ch == '_' || ch == '~') {
                             name.prepend(ch);
                         } else {
                             break;
                         }
                     }
-                    fclose(f);
                     if (!name.isEmpty()) {
                         RTags::Filter out;
                         out.kinds.insert(CXCursor_MemberRefExpr);
@@ -561,7 +566,7 @@ void IndexerJobClang::handleReference(const CXCursor &cursor, CXCursorKind kind,
         info.type = clang_getCursorType(cursor).kind;
     }
 
-    Set<Location> &val = mData->references[location];
+    ArenaSet<Location> &val = mData->references[location];
     val.insert(reffedLoc);
 
 }
@@ -809,9 +814,23 @@ bool IndexerJobClang::handleCursor(const CXCursor &cursor, CXCursorKind kind, co
         // their definition and their declaration.  Using the canonical
         // cursor's usr allows us to join them. Check JSClassRelease in
         // JavaScriptCore for an example.
-        const String usr = RTags::eatString(clang_getCursorUSR(clang_getCanonicalCursor(cursor)));
-        if (!usr.isEmpty())
-            mData->usrMap[usr].insert(location);
+        CXString usr = clang_getCursorUSR(clang_getCanonicalCursor(cursor));
+        const char *usrString = clang_getCString(usr);
+        if (const uint64_t hash = RTags::usrHash(usrString)) {
+            // only the hash makes it into the project so a collision would
+            // join unrelated cursors, the USRs are compared while we have
+            // them and the later one is left out
+            String &existing = mUsrs[hash];
+            if (existing.isEmpty()) {
+                existing = usrString;
+                mData->usrMap[hash].insert(location);
+            } else if (existing == usrString) {
+                mData->usrMap[hash].insert(location);
+            } else {
+                error() << "USR hash collision between" << existing << "and" << usrString << "at" << location;
+            }
+        }
+        clang_disposeString(usr);
 
         switch (info.kind) {
         case CXCursor_Constructor:
@@ -850,9 +869,39 @@ bool IndexerJobClang::parse()
                               static_cast<unsigned long>(mContents.size()) };
 
     mParseDuration = mTimer.elapsed();
-    RTags::parseTranslationUnit(sourceFile, args,
-                                unit, Server::instance()->clangIndex(), mClangLine,
-                                mSourceInformation.fileId, &mData->dependencies, &unsaved, 1);
+    // A dirty job has to see the bodies of the headers that changed, the
+    // session only knows where bodies were, not whether they're still the same
+    std::shared_ptr<Project> proj = project();
+    std::shared_ptr<IndexSession> session;
+    if (type() == Makefile && proj)
+        session = proj->indexSession();
+    if (session) {
+        IndexerCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.abortQuery = IndexerJobClang::abortQuery;
+        callbacks.enteredMainFile = IndexerJobClang::enteredMainFile;
+        callbacks.ppIncludedFile = IndexerJobClang::includedFile;
+        RTags::indexTranslationUnit(sourceFile, args, unit, session->action(), &callbacks, this, mClangLine,
+                                    mSourceInformation.fileId, &mData->dependencies, &unsaved, 1);
+        // The bodies we skipped were parsed by jobs that finished before we
+        // started and claimed the files before us. If files were released
+        // since, we may have claimed one of them without its bodies. If the
+        // session failed, clang disposed the unit and the one we parse
+        // normally must not see the CXFiles the callbacks cached.
+        if (!unit || proj->indexSession() != session) {
+            if (unit) {
+                clang_disposeTranslationUnit(unit);
+                unit = 0;
+            }
+            mCXFileIds.clear();
+            session.reset();
+        }
+    }
+    if (!session) {
+        RTags::parseTranslationUnit(sourceFile, args,
+                                    unit, Server::instance()->clangIndex(), mClangLine,
+                                    mSourceInformation.fileId, &mData->dependencies, &unsaved, 1);
+    }
     mParseDuration = mTimer.elapsed() - mParseDuration;
     mParseTime = time(0);
     warning() << "loading unit " << mClangLine << " " << (unit != 0);
@@ -875,6 +924,7 @@ bool IndexerJobClang::parse()
         clang_getInclusions(unit, IndexerJobClang::inclusionVisitor, this);
         clang_disposeTranslationUnit(unit);
         unit = 0;
+        mCXFileIds.clear();
     } else if (type() != Dump) {
         mData->dependencies[mSourceInformation.fileId].insert(mSourceInformation.fileId);
     }
@@ -1160,7 +1210,8 @@ void IndexerJobClang::index()
 {
     const Path sourceFile = mSourceInformation.sourceFile();
     // mLogFile = fopen(String::format("/tmp/%s.old", sourceFile.fileName()).constData(), "w");
-    mContents = sourceFile.readAll();
+    if (const std::shared_ptr<const FileContents> contents = FileCache::contents(sourceFile))
+        mContents = contents->contents();
 
     if (type() == Dump) {
         assert(id() != -1);
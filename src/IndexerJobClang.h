@@ -64,6 +64,15 @@ private:
     bool visit();
     bool parse();
     void addFileSymbol(uint32_t file);
+    // a CXFile is the same for every location in a file while the
+    // translation unit is alive so its name is only looked up once
+    inline uint32_t resolveFile(CXFile file)
+    {
+        uint32_t &fileId = mCXFileIds[file];
+        if (!fileId)
+            fileId = insertFile(RTags::eatString(clang_getFileName(file)));
+        return fileId;
+    }
     using IndexerJob::createLocation;
     inline Location createLocation(const CXSourceLocation &location, bool *blocked)
     {
@@ -74,7 +83,7 @@ private:
         unsigned start;
         clang_getSpellingLocation(location, &file, 0, 0, &start);
         if (file) {
-            return createLocation(RTags::eatString(clang_getFileName(file)), start, blocked);
+            return createLocation(resolveFile(file), start, blocked);
         }
         return Location();
     }
@@ -83,6 +92,9 @@ private:
         return createLocation(clang_getCursorLocation(cursor), blocked);
     }
     String addNamePermutations(const CXCursor &cursor, const Location &location);
+    static int abortQuery(CXClientData userData, void *);
+    static CXIdxClientFile enteredMainFile(CXClientData userData, CXFile file, void *);
+    static CXIdxClientFile includedFile(CXClientData userData, const CXIdxIncludedFileInfo *info);
     static CXChildVisitResult indexVisitor(CXCursor cursor, CXCursor parent, CXClientData client_data);
     static CXChildVisitResult verboseVisitor(CXCursor cursor, CXCursor, CXClientData userData);
     static CXChildVisitResult dumpVisitor(CXCursor cursor, CXCursor, CXClientData userData);
@@ -102,6 +114,8 @@ private:
 
     String mClangLine;
     CXCursor mLastCursor;
+    Hash<CXFile, uint32_t> mCXFileIds;
+    Hash<uint64_t, String> mUsrs; // RTags::usrHash() -> USR
     String mContents;
     int mParseDuration, mVisitDuration, mBlocked, mAllowed;
 };
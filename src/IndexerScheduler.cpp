@@ -0,0 +1,169 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "IndexerScheduler.h"
+#include <rct/Rct.h>
+#include <algorithm>
+#include <assert.h>
+
+class IndexerSlot : public ThreadPool::Job
+{
+public:
+    IndexerSlot(IndexerScheduler *scheduler)
+        : mScheduler(scheduler)
+    {}
+
+    virtual void run()
+    {
+        std::function<void()> job;
+        if (mScheduler->take(job)) {
+            job();
+            job = nullptr;
+            mScheduler->onJobFinished();
+        }
+    }
+private:
+    IndexerScheduler *mScheduler;
+};
+
+IndexerScheduler::IndexerScheduler(ThreadPool *threadPool, int maxJobs)
+    : mThreadPool(threadPool), mMaxJobs(maxJobs), mRunning(0), mPassed(0), mAged(0)
+{
+}
+
+void IndexerScheduler::start(Level level, std::function<void()> &&job)
+{
+    assert(level >= 0 && level < LevelCount);
+    bool slot = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Task task = { std::move(job), Rct::monoMs() };
+        mQueues[level].push_back(std::move(task));
+        if (mRunning < mMaxJobs) {
+            ++mRunning;
+            slot = true;
+        }
+    }
+    if (slot)
+        startSlots(1);
+}
+
+void IndexerScheduler::setMaxJobs(int maxJobs)
+{
+    int slots = 0;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMaxJobs = maxJobs;
+        // slots above the new max stop in take()
+        int queued = 0;
+        for (int i=0; i<LevelCount; ++i)
+            queued += mQueues[i].size();
+        slots = std::max(0, std::min(queued, mMaxJobs) - mRunning);
+        mRunning += slots;
+    }
+    startSlots(slots);
+}
+
+void IndexerScheduler::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (int i=0; i<LevelCount; ++i)
+        mQueues[i].clear();
+}
+
+void IndexerScheduler::startSlots(int count)
+{
+    for (int i=0; i<count; ++i)
+        mThreadPool->start(std::shared_ptr<ThreadPool::Job>(new IndexerSlot(this)));
+}
+
+bool IndexerScheduler::take(std::function<void()> &job)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    int level = 0;
+    while (level < LevelCount && mQueues[level].empty())
+        ++level;
+    if (level == LevelCount || mRunning > mMaxJobs) {
+        --mRunning;
+        return false;
+    }
+
+    const uint64_t now = Rct::monoMs();
+    int aged = -1;
+    for (int i=level + 1; i<LevelCount; ++i) {
+        if (!mQueues[i].empty()) {
+            const uint64_t queued = mQueues[i].front().queued;
+            if (now - queued >= AgingInterval && (aged == -1 || queued < mQueues[aged].front().queued))
+                aged = i;
+        }
+    }
+    if (aged == -1) {
+        mPassed = 0;
+    } else if (++mPassed > AgedShare) {
+        mPassed = 0;
+        level = aged;
+        ++mAged;
+    }
+
+    job = std::move(mQueues[level].front().job);
+    mQueues[level].pop_front();
+    return true;
+}
+
+void IndexerScheduler::onJobFinished()
+{
+    bool slot = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mRunning <= mMaxJobs) {
+            for (int i=0; i<LevelCount; ++i) {
+                if (!mQueues[i].empty()) {
+                    slot = true;
+                    break;
+                }
+            }
+        }
+        if (!slot)
+            --mRunning;
+    }
+    // a new slot goes to the back of the pool's queue so other jobs in the
+    // pool, e.g. ScanJob, don't wait for the whole backlog
+    if (slot)
+        startSlots(1);
+}
+
+IndexerScheduler::Status IndexerScheduler::status() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    Status ret;
+    for (int i=0; i<LevelCount; ++i)
+        ret.queued[i] = mQueues[i].size();
+    ret.running = mRunning;
+    ret.maxJobs = mMaxJobs;
+    ret.aged = mAged;
+    return ret;
+}
+
+const char *IndexerScheduler::levelName(Level level)
+{
+    switch (level) {
+    case CurrentFile: return "currentfile";
+    case Dirty: return "dirty";
+    case Makefile: return "makefile";
+    case Dump: return "dump";
+    case LevelCount: break;
+    }
+    return "";
+}
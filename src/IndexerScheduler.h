@@ -0,0 +1,82 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef IndexerScheduler_h
+#define IndexerScheduler_h
+
+#include <rct/LinkedList.h>
+#include <rct/ThreadPool.h>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+
+// Queues indexer jobs by level in front of the indexer ThreadPool. At most
+// maxJobs slots are in the pool at a time. A slot takes the most urgent job
+// when the pool runs it and re-posts itself when the job is done, so a
+// dirty job for the file being edited doesn't wait behind a compilation
+// database worth of jobs that were started before it.
+//
+// Jobs are run first come, first served within a level. To keep the lower
+// levels from starving while the higher ones are busy, one job in every
+// AgedShare + 1 is taken from the level whose first job has waited the
+// longest, once that is at least AgingInterval.
+class IndexerScheduler
+{
+public:
+    enum Level {
+        CurrentFile, // dirty jobs for, or including, the current file
+        Dirty,
+        Makefile,
+        Dump,
+        LevelCount
+    };
+    enum {
+        AgingInterval = 10000, // ms
+        AgedShare = 3
+    };
+    IndexerScheduler(ThreadPool *threadPool, int maxJobs);
+
+    void start(Level level, std::function<void()> &&job);
+    void setMaxJobs(int maxJobs);
+    // drops the queued jobs, running ones finish
+    void clear();
+
+    struct Status {
+        int queued[LevelCount];
+        int running, maxJobs;
+        uint64_t aged;
+    };
+    Status status() const;
+    static const char *levelName(Level level);
+private:
+    bool take(std::function<void()> &job);
+    void onJobFinished();
+    void startSlots(int count);
+
+    struct Task {
+        std::function<void()> job;
+        uint64_t queued;
+    };
+
+    mutable std::mutex mMutex;
+    ThreadPool *mThreadPool;
+    LinkedList<Task> mQueues[LevelCount];
+    int mMaxJobs, mRunning, mPassed;
+    uint64_t mAged;
+
+    friend class IndexerSlot;
+};
+
+#endif
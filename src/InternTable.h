@@ -0,0 +1,397 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef InternTable_h
+#define InternTable_h
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <assert.h>
+#include <stdint.h>
+
+// Table of values with a 32-bit id each, used for the fileIds in
+// Location.cpp and the symbol names in SymbolName.cpp. Both are read for
+// every cursor by the indexers and for every line of output by the queries
+// so looking up a value that's already there doesn't lock.
+//
+// Values live in fixed size chunks that are allocated as needed and never
+// move or go away. The value -> id direction is an open addressing hash of
+// (hash << 32 | id) entries that's replaced when it's half full. Writers
+// serialize on mMutex and publish an id only after its value is in place.
+//
+// Without Recycle ids live forever and a replaced hash is kept around since
+// a reader might still be probing it. With Recycle ids are reference counted
+// by their users through insert(), retain() and release(). An id that's no
+// longer used is taken out of the hash right away but it's only handed out
+// again, and replaced hashes are only freed, once every reader that could
+// still be probing them is done. Readers count themselves in mReaders under
+// the current epoch and the writers wait for the previous epoch to drain.
+//
+// T is a Path or a String. The constructor is constexpr so static tables
+// can be used before any dynamic initializer has run, and they're never
+// destroyed.
+template <typename T, int ChunkBits, bool Recycle>
+class InternTable
+{
+public:
+    enum {
+        ChunkSize = 1 << ChunkBits,
+        MaxChunks = 1 << 16,
+        InitialCapacity = 4096
+    };
+
+    constexpr InternTable()
+        : mChunks(), mLimit(1), mCount(0), mTable(nullptr), mEpoch(0), mReaders(),
+          mFree(0), mPending(0), mWaiting(0), mRetired(nullptr), mWaitingTables(nullptr), mMemory(0)
+    {}
+
+    static uint32_t maxId() { return static_cast<uint32_t>(ChunkSize) * MaxChunks - 1; }
+
+    // ids below this have been handed out, 0 never is
+    uint32_t limit() const { return mLimit.load(std::memory_order_acquire); }
+    int count() const { return mCount.load(std::memory_order_relaxed); }
+
+    const T &at(uint32_t id) const
+    {
+        const Slot *chunk = mChunks[id >> ChunkBits].load(std::memory_order_acquire);
+        return chunk ? chunk[id & (ChunkSize - 1)].value : empty();
+    }
+
+    // Only without Recycle, the id could be gone by the time it's used
+    uint32_t find(const T &value) const
+    {
+        static_assert(!Recycle, "find() doesn't retain the id");
+        return lookup(mTable.load(std::memory_order_acquire), value, hashValue(value));
+    }
+
+    // Returns the id of value, adding it if it isn't there, or 0 if the
+    // table is full. With Recycle the caller has to release() it.
+    uint32_t insert(const T &value)
+    {
+        const uint32_t hash = hashValue(value);
+        {
+            const ReadScope scope(this);
+            const uint32_t id = lookup(mTable.load(std::memory_order_acquire), value, hash);
+            if (id && (!Recycle || tryRetain(id)))
+                return id;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (const uint32_t id = lookup(mTable.load(std::memory_order_relaxed), value, hash)) {
+            // its last user might be waiting for the lock to take it out
+            if (Recycle)
+                slot(id).refs.fetch_add(1, std::memory_order_relaxed);
+            return id;
+        }
+        if (Recycle)
+            reclaim();
+        uint32_t id = mFree;
+        if (id) {
+            mFree = slot(id).next;
+        } else {
+            id = mLimit.load(std::memory_order_relaxed);
+            if ((id >> ChunkBits) >= MaxChunks)
+                return 0;
+        }
+        place(value, hash, id);
+        if (id == mLimit.load(std::memory_order_relaxed))
+            mLimit.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    // id has to be held by the caller already
+    void retain(uint32_t id)
+    {
+        slot(id).refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(uint32_t id)
+    {
+        Slot &s = slot(id);
+        if (s.refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!s.live || s.refs.load(std::memory_order_relaxed))
+            return;
+        const uint64_t entry = (static_cast<uint64_t>(hashValue(s.value)) << 32) | id;
+        IdTable *table = mTable.load(std::memory_order_relaxed);
+        const uint32_t mask = table->capacity - 1;
+        uint32_t i = static_cast<uint32_t>(entry >> 32) & mask;
+        while (table->slots[i].load(std::memory_order_relaxed) != entry)
+            i = (i + 1) & mask;
+        table->slots[i].store(Tombstone, std::memory_order_relaxed);
+        s.live = false;
+        mCount.fetch_sub(1, std::memory_order_relaxed);
+        s.next = mPending;
+        mPending = id;
+        reclaim();
+    }
+
+    // Replaces the contents with the (value, id) pairs in values. Only
+    // without Recycle.
+    template <typename Container>
+    void assign(const Container &values)
+    {
+        static_assert(!Recycle, "ids are held by their users");
+        std::lock_guard<std::mutex> lock(mMutex);
+        const uint32_t limit = mLimit.load(std::memory_order_relaxed);
+        for (uint32_t i=1; i<limit; ++i) {
+            if (Slot *chunk = mChunks[i >> ChunkBits].load(std::memory_order_relaxed)) {
+                Slot &s = chunk[i & (ChunkSize - 1)];
+                if (s.live) {
+                    mMemory -= s.value.size();
+                    s.value = T();
+                    s.live = false;
+                }
+            }
+        }
+        uint32_t capacity = InitialCapacity;
+        while (capacity < static_cast<uint32_t>(values.size()) * 2 + 2)
+            capacity *= 2;
+        IdTable *table = new IdTable(capacity, mTable.load(std::memory_order_relaxed));
+        mMemory += capacity * sizeof(uint64_t);
+        mTable.store(table, std::memory_order_release);
+        mCount.store(0, std::memory_order_relaxed);
+        uint32_t last = 0;
+        for (typename Container::const_iterator it = values.begin(); it != values.end(); ++it) {
+            assert((it->second >> ChunkBits) < MaxChunks);
+            place(it->first, hashValue(it->first), it->second);
+            last = std::max(last, it->second);
+        }
+        mLimit.store(last + 1, std::memory_order_release);
+    }
+
+    uint64_t memoryUsage() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mMemory;
+    }
+private:
+    struct Slot
+    {
+        Slot()
+            : refs(0), next(0), live(false)
+        {}
+
+        T value;
+        std::atomic<uint32_t> refs; // only with Recycle
+        uint32_t next; // free or pending list, mMutex
+        bool live; // in the hash, mMutex
+    };
+
+    struct IdTable
+    {
+        IdTable(uint32_t cap, IdTable *prev)
+            : capacity(cap), used(0), slots(new std::atomic<uint64_t>[cap]), retired(prev)
+        {
+            for (uint32_t i=0; i<capacity; ++i)
+                slots[i].store(0, std::memory_order_relaxed);
+        }
+        ~IdTable() { delete[] slots; }
+
+        const uint32_t capacity; // power of two
+        uint32_t used; // entries and tombstones, only touched by writers
+        std::atomic<uint64_t> *slots;
+        IdTable *retired; // the one this replaced or the next one to free, mMutex
+    };
+
+    // hashes are never 0 so this is neither empty nor a valid entry
+    enum { Tombstone = 1 };
+
+    class ReadScope
+    {
+    public:
+        ReadScope(const InternTable *table)
+            : mReaders(0)
+        {
+            if (!Recycle)
+                return;
+            for (;;) {
+                const uint32_t epoch = table->mEpoch.load(std::memory_order_relaxed);
+                mReaders = &table->mReaders[epoch & 1];
+                mReaders->fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                // a writer might have moved on before seeing us
+                if (table->mEpoch.load(std::memory_order_acquire) == epoch)
+                    break;
+                mReaders->fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        ~ReadScope()
+        {
+            if (mReaders)
+                mReaders->fetch_sub(1, std::memory_order_release);
+        }
+    private:
+        std::atomic<int> *mReaders;
+    };
+
+    static const T &empty()
+    {
+        static const T e;
+        return e;
+    }
+
+    static uint32_t hashValue(const T &value)
+    {
+        // fnv-1a, 0 marks an empty slot
+        uint32_t hash = 2166136261U;
+        const char *data = value.constData();
+        for (int i=0; i<value.size(); ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 16777619U;
+        }
+        return hash ? hash : 1;
+    }
+
+    Slot &slot(uint32_t id) const
+    {
+        return mChunks[id >> ChunkBits].load(std::memory_order_acquire)[id & (ChunkSize - 1)];
+    }
+
+    uint32_t lookup(const IdTable *table, const T &value, uint32_t hash) const
+    {
+        if (!table)
+            return 0;
+        const uint32_t mask = table->capacity - 1;
+        for (uint32_t i=hash & mask; ; i = (i + 1) & mask) {
+            const uint64_t entry = table->slots[i].load(std::memory_order_acquire);
+            if (!entry)
+                return 0;
+            if (static_cast<uint32_t>(entry >> 32) == hash && at(static_cast<uint32_t>(entry)) == value)
+                return static_cast<uint32_t>(entry);
+        }
+    }
+
+    bool tryRetain(uint32_t id)
+    {
+        // a count of 0 means the id is on its way out, take the lock
+        std::atomic<uint32_t> &refs = slot(id).refs;
+        uint32_t count = refs.load(std::memory_order_relaxed);
+        while (count) {
+            if (refs.compare_exchange_weak(count, count + 1, std::memory_order_relaxed))
+                return true;
+        }
+        return false;
+    }
+
+    static void insertEntry(IdTable *table, uint64_t entry) // mMutex always held
+    {
+        const uint32_t mask = table->capacity - 1;
+        uint32_t i = static_cast<uint32_t>(entry >> 32) & mask;
+        for (;;) {
+            const uint64_t old = table->slots[i].load(std::memory_order_relaxed);
+            if (!old) {
+                ++table->used;
+                break;
+            } else if (old == Tombstone) {
+                break;
+            }
+            i = (i + 1) & mask;
+        }
+        table->slots[i].store(entry, std::memory_order_release);
+    }
+
+    void place(const T &value, uint32_t hash, uint32_t id) // mMutex always held
+    {
+        Slot *chunk = mChunks[id >> ChunkBits].load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new Slot[ChunkSize];
+            mChunks[id >> ChunkBits].store(chunk, std::memory_order_release);
+            mMemory += ChunkSize * sizeof(Slot);
+        }
+        Slot &s = chunk[id & (ChunkSize - 1)];
+        s.value = value;
+        s.refs.store(Recycle ? 1 : 0, std::memory_order_relaxed);
+        s.live = true;
+        mMemory += value.size();
+        mCount.fetch_add(1, std::memory_order_relaxed);
+
+        IdTable *table = mTable.load(std::memory_order_relaxed);
+        if (!table) {
+            table = new IdTable(InitialCapacity, 0);
+            mTable.store(table, std::memory_order_release);
+            mMemory += table->capacity * sizeof(uint64_t);
+        } else if ((table->used + 1) * 2 > table->capacity) {
+            // mostly tombstones, rebuild at the same size
+            uint32_t capacity = table->capacity;
+            if ((static_cast<uint32_t>(count()) + 1) * 4 > capacity)
+                capacity *= 2;
+            IdTable *grown = new IdTable(capacity, Recycle ? 0 : table);
+            for (uint32_t i=0; i<table->capacity; ++i) {
+                const uint64_t entry = table->slots[i].load(std::memory_order_relaxed);
+                if (entry && entry != Tombstone)
+                    insertEntry(grown, entry);
+            }
+            mTable.store(grown, std::memory_order_release);
+            mMemory += grown->capacity * sizeof(uint64_t);
+            if (Recycle) {
+                table->retired = mRetired;
+                mRetired = table;
+            }
+            table = grown;
+        }
+        insertEntry(table, (static_cast<uint64_t>(hash) << 32) | id);
+    }
+
+    // Hands out the ids and frees the hashes that were taken out before the
+    // last epoch change once the readers from before it are gone, then starts
+    // a new epoch for the ones taken out since.
+    void reclaim() // mMutex always held
+    {
+        for (;;) {
+            if (mWaiting || mWaitingTables) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (mReaders[(mEpoch.load(std::memory_order_relaxed) + 1) & 1].load(std::memory_order_acquire))
+                    return;
+                while (IdTable *table = mWaitingTables) {
+                    mWaitingTables = table->retired;
+                    mMemory -= table->capacity * sizeof(uint64_t);
+                    delete table;
+                }
+                while (mWaiting) {
+                    Slot &s = slot(mWaiting);
+                    const uint32_t next = s.next;
+                    mMemory -= s.value.size();
+                    s.value = T();
+                    s.next = mFree;
+                    mFree = mWaiting;
+                    mWaiting = next;
+                }
+            }
+            if (!mPending && !mRetired)
+                return;
+            mWaiting = mPending;
+            mWaitingTables = mRetired;
+            mPending = 0;
+            mRetired = 0;
+            mEpoch.store(mEpoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    }
+
+    std::atomic<Slot*> mChunks[MaxChunks];
+    std::atomic<uint32_t> mLimit, mCount;
+    std::atomic<IdTable*> mTable; // created by the first insert
+    std::atomic<uint32_t> mEpoch;
+    mutable std::atomic<int> mReaders[2]; // by epoch
+    mutable std::mutex mMutex;
+    // lists of ids through Slot::next and of hashes through IdTable::retired,
+    // pending ones were taken out during this epoch, waiting ones before it
+    uint32_t mFree, mPending, mWaiting; // mMutex
+    IdTable *mRetired, *mWaitingTables; // mMutex
+    uint64_t mMemory; // mMutex
+};
+
+#endif
@@ -18,6 +18,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include <rct/EventLoop.h>
 #include "Server.h"
 #include "CursorInfo.h"
+#include "FileSymbols.h"
 #include <rct/RegExp.h>
 #include "QueryMessage.h"
 #include "Project.h"
@@ -152,29 +153,22 @@ bool Job::write(const Location &location, unsigned flags)
     const bool cursorKind = queryFlags() & QueryMessage::CursorKind;
     const bool displayName = queryFlags() & QueryMessage::DisplayName;
     if (containingFunction || cursorKind || displayName) {
-        const SymbolMap &symbols = project()->symbols();
-        SymbolMap::const_iterator it = symbols.find(location);
-        if (it == symbols.end()) {
+        std::shared_ptr<Project> proj = project();
+        const SymbolMap &symbols = proj->symbols();
+        const std::shared_ptr<FileSymbols> fileSymbols = proj->fileSymbols(location.fileId());
+        const int idx = fileSymbols->indexOf(location.offset());
+        if (idx == -1) {
             error() << "Somehow can't find" << location << "in symbols";
         } else {
+            const SymbolMap::const_iterator it = fileSymbols->cursor(idx);
             if (displayName)
                 out += '\t' + it->second.displayName();
             if (cursorKind)
                 out += '\t' + it->second.kindSpelling();
             if (containingFunction) {
-                const uint32_t fileId = location.fileId();
-                const int offset = location.offset();
-                while (true) {
-                    --it;
-                    if (it->first.fileId() != fileId)
-                        break;
-                    if (it->second.isDefinition() && RTags::isContainer(it->second.kind) && offset >= it->second.start && offset <= it->second.end) {
-                        out += "\tfunction: " + it->second.symbolName;
-                        break;
-                    } else if (it == symbols.begin()) {
-                        break;
-                    }
-                }
+                const SymbolMap::const_iterator container = fileSymbols->container(idx, location.offset(), symbols.end());
+                if (container != symbols.end())
+                    out += "\tfunction: " + container->second.symbolName.string();
             }
         }
     }
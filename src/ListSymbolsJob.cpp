@@ -18,6 +18,8 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Project.h"
 #include <rct/Log.h>
 #include "RTags.h"
+#include "SymbolNameIndex.h"
+#include "SystemIndex.h"
 
 enum {
     DefaultFlags = Job::WriteUnfiltered|Job::WriteBuffered|Job::QuietJob,
@@ -120,37 +122,47 @@ Set<String> ListSymbolsJob::listSymbols(const std::shared_ptr<Project> &project)
     const bool hasFilter = Job::hasFilter();
     const bool stripParentheses = queryFlags() & QueryMessage::StripParentheses;
 
-    const SymbolNameMap &map = project->symbolNames();
-    SymbolNameMap::const_iterator it = string.isEmpty() ? map.begin() : map.lower_bound(string);
     int count = 0;
-    while (it != map.end()) {
-        const String &entry = it->first;
-        ++it;
-        if (!string.isEmpty() && !entry.startsWith(string))
-            break;
-        bool ok = true;
-        if (hasFilter) {
-            ok = false;
-            const Set<Location> &locations = it->second;
-            for (Set<Location>::const_iterator i = locations.begin(); i != locations.end(); ++i) {
-                if (filter(i->path())) {
-                    ok = true;
-                    break;
+    auto list = [&](const SymbolNameIndex &index) {
+        for (SymbolNameIndex::const_iterator it = index.lowerBound(string); it != index.end(); ++it) {
+            if (!SymbolNameIndex::startsWith(it, string))
+                break;
+            const String entry = SymbolNameIndex::name(it);
+            bool ok = true;
+            if (hasFilter) {
+                ok = false;
+                const Set<Location> &locations = SymbolNameIndex::locations(it);
+                for (Set<Location>::const_iterator l = locations.begin(); l != locations.end(); ++l) {
+                    if (filter(l->path())) {
+                        ok = true;
+                        break;
+                    }
                 }
             }
-        }
-        if (ok) {
-            const int paren = entry.indexOf('(');
-            if (paren == -1) {
-                out.insert(entry);
-            } else {
-                out.insert(entry.left(paren));
-                if (!stripParentheses)
+            if (ok) {
+                const int paren = entry.indexOf('(');
+                if (paren == -1) {
                     out.insert(entry);
+                } else {
+                    out.insert(entry.left(paren));
+                    if (!stripParentheses)
+                        out.insert(entry);
+                }
             }
+            if (!(++count % 100) && isAborted())
+                return false;
+        }
+        return true;
+    };
+
+    const std::shared_ptr<SymbolNameIndex> index = project->symbolNameIndex();
+    if (list(*index)) {
+        // names declared in system headers live in the shared shards
+        const List<std::shared_ptr<const SystemShard> > shards = project->systemShards();
+        for (int i=0; i<shards.size(); ++i) {
+            if (!list(*shards.at(i)->names))
+                break;
         }
-        if (!(++count % 100) && isAborted())
-            break;
     }
     return out;
 }
@@ -14,13 +14,87 @@ You should have received a copy of the GNU General Public License
 along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "Location.h"
+#include "FileCache.h"
 #include "Server.h"
 #include <rct/Rct.h>
 #include "RTags.h"
-Hash<Path, uint32_t> Location::sPathsToIds;
-Hash<uint32_t, Path> Location::sIdsToPaths;
-uint32_t Location::sLastId = 0;
-std::mutex Location::sMutex;
+#include "InternTable.h"
+
+// fileIds are stored in the database so they're never recycled
+static InternTable<Path, 12, false> sPaths;
+
+uint32_t Location::fileId(const Path &path)
+{
+    return sPaths.find(path);
+}
+
+Path Location::path(uint32_t id)
+{
+    if (!id || id >= sPaths.limit())
+        return Path();
+    return sPaths.at(id);
+}
+
+uint32_t Location::insertFile(const Path &path)
+{
+    const uint32_t id = sPaths.insert(path);
+    assert(id);
+    return id;
+}
+
+int Location::fileCount()
+{
+    return sPaths.count();
+}
+
+uint64_t Location::memoryUsage()
+{
+    return sPaths.memoryUsage();
+}
+
+Hash<uint32_t, Path> Location::idsToPaths()
+{
+    Hash<uint32_t, Path> ret;
+    const uint32_t limit = sPaths.limit();
+    for (uint32_t i=1; i<limit; ++i) {
+        const Path &path = sPaths.at(i);
+        if (!path.isEmpty())
+            ret[i] = path;
+    }
+    return ret;
+}
+
+Hash<Path, uint32_t> Location::pathsToIds()
+{
+    Hash<Path, uint32_t> ret;
+    const uint32_t limit = sPaths.limit();
+    for (uint32_t i=1; i<limit; ++i) {
+        const Path &path = sPaths.at(i);
+        if (!path.isEmpty())
+            ret[path] = i;
+    }
+    return ret;
+}
+
+void Location::init(const Hash<Path, uint32_t> &pathsToIds)
+{
+    sPaths.assign(pathsToIds);
+}
+
+List<Path> Location::pathsSince(uint32_t id, uint32_t *lastId)
+{
+    List<Path> ret;
+    const uint32_t limit = sPaths.limit();
+    for (uint32_t i=id + 1; i<limit; ++i)
+        ret.append(sPaths.at(i));
+    *lastId = limit - 1;
+    return ret;
+}
+
+uint32_t Location::maxFileId()
+{
+    return sPaths.maxId();
+}
 
 String Location::key(unsigned flags) const
 {
@@ -28,10 +102,11 @@ String Location::key(unsigned flags) const
         return String();
     int extra = 0;
     const int off = offset();
+    const Path p = path();
     int line = 0, col = 0;
     if (flags & Location::Padded) {
         extra = 7;
-    } else if (flags & Location::ShowLineNumbers && convertOffset(line, col)) {
+    } else if (flags & Location::ShowLineNumbers && convertOffset(p, off, line, col)) {
         extra = RTags::digits(line) + RTags::digits(col) + 3;
     } else {
         flags &= ~Location::ShowLineNumbers;
@@ -40,12 +115,10 @@ String Location::key(unsigned flags) const
     String ctx;
     if (flags & Location::ShowContext) {
         ctx += '\t';
-        ctx += context();
+        ctx += context(p, off, 0);
         extra += ctx.size();
     }
 
-    const Path p = path();
-
     String ret(p.size() + extra, '0');
 
     if (flags & Location::Padded) {
@@ -61,62 +134,18 @@ String Location::key(unsigned flags) const
     return ret;
 }
 
-String Location::context(int *column) const
+String Location::context(const Path &path, uint32_t off, int *column)
 {
-    const uint32_t off = offset();
-    uint32_t o = off;
-    Path p = path();
-    FILE *f = fopen(p.constData(), "r");
-    if (f && !fseek(f, off, SEEK_SET)) {
-        while (o > 0) {
-            const char ch = fgetc(f);
-            if (ch == '\n' && o != off)
-                break;
-            if (fseek(f, --o, SEEK_SET) == -1) {
-                fclose(f);
-                return String();
-            }
-        }
-        char buf[1024] = { '\0' };
-        const int len = Rct::readLine(f, buf, 1023);
-        fclose(f);
-        if (column)
-            *column = (off - o - 1);
-        return String(buf, len);
-    }
-    if (f)
-        fclose(f);
-    return String();
+    const std::shared_ptr<const FileContents> contents = FileCache::contents(path);
+    return contents ? contents->context(off, column) : String();
 }
 
-bool Location::convertOffset(int &line, int &col) const
+bool Location::convertOffset(const Path &path, uint32_t off, int &line, int &col)
 {
-    const uint32_t off = offset();
-    Path p = path();
-    FILE *f = fopen(p.constData(), "r");
-    if (!f) {
+    const std::shared_ptr<const FileContents> contents = FileCache::contents(path);
+    if (!contents) {
         line = col = -1;
         return false;
     }
-    line = 1;
-    int last = 0;
-    uint32_t idx = 0;
-    while (true) {
-        const int lineLen = Rct::readLine(f);
-        if (lineLen == -1) {
-            col = line = -1;
-            fclose(f);
-            return false;
-        }
-        idx += lineLen + 1;
-        // printf("lineStart %d offset %d last %d lineLen %d\n", idx, offset, last, lineLen);
-        if (idx > off) {
-            col = off - last + 1;
-            break;
-        }
-        last = idx;
-        ++line;
-    }
-    fclose(f);
-    return true;
+    return contents->convertOffset(off, line, col);
 }
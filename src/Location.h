@@ -20,6 +20,9 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include <rct/Log.h>
 #include <rct/Path.h>
 #include <rct/Serializer.h>
+#include <rct/Set.h>
+#include <rct/List.h>
+#include <algorithm>
 #include <mutex>
 #include <assert.h>
 #include <clang-c/Index.h>
@@ -69,47 +72,21 @@ public:
         return !mData;
     }
 
-    static inline uint32_t fileId(const Path &path)
-    {
-        std::lock_guard<std::mutex> lock(sMutex);
-        return sPathsToIds.value(path);
-    }
-    static inline Path path(uint32_t id)
-    {
-        std::lock_guard<std::mutex> lock(sMutex);
-        return sIdsToPaths.value(id);
-    }
-
-    static inline uint32_t insertFile(const Path &path)
-    {
-        uint32_t ret;
-        {
-            std::lock_guard<std::mutex> lock(sMutex);
-            uint32_t &id = sPathsToIds[path];
-            if (!id) {
-                id = ++sLastId;
-                sIdsToPaths[id] = path;
-            }
-            ret = id;
-        }
-
-        return ret;
-    }
+    // these don't lock, only inserting a new path does
+    static uint32_t fileId(const Path &path);
+    static Path path(uint32_t id);
+    static uint32_t insertFile(const Path &path);
+    // number of files in the table and the memory it takes up
+    static int fileCount();
+    static uint64_t memoryUsage();
 
     inline uint32_t fileId() const { return uint32_t(mData); }
     inline uint32_t offset() const { return uint32_t(mData >> 32); }
 
-    inline Path path() const
-    {
-        if (mCachedPath.isEmpty()) {
-            std::lock_guard<std::mutex> lock(sMutex);
-            mCachedPath = sIdsToPaths.value(fileId());
-        }
-        return mCachedPath;
-    }
+    inline Path path() const { return path(fileId()); }
     inline bool isNull() const { return !mData; }
     inline bool isValid() const { return mData; }
-    inline void clear() { mData = 0; mCachedPath.clear(); }
+    inline void clear() { mData = 0; }
     inline bool operator==(const String &str) const
     {
         const Location fromPath = Location::fromPathAndOffset(str);
@@ -155,8 +132,8 @@ public:
         return offset() > other.offset();
     }
 
-    String context(int *column = 0) const;
-    bool convertOffset(int &line, int &col) const;
+    String context(int *column = 0) const { return context(path(), offset(), column); }
+    bool convertOffset(int &line, int &col) const { return convertOffset(path(), offset(), line, col); }
 
     enum KeyFlag {
         NoFlag = 0x0,
@@ -225,32 +202,18 @@ public:
         }
         return Location(Location::insertFile(Path(pathAndOffset.left(comma))), fileId);
     }
-    static Hash<uint32_t, Path> idsToPaths()
-    {
-        std::lock_guard<std::mutex> lock(sMutex);
-        return sIdsToPaths;
-    }
-    static Hash<Path, uint32_t> pathsToIds()
-    {
-        std::lock_guard<std::mutex> lock(sMutex);
-        return sPathsToIds;
-    }
-    static void init(const Hash<Path, uint32_t> &pathsToIds)
-    {
-        std::lock_guard<std::mutex> lock(sMutex);
-        sPathsToIds = pathsToIds;
-        sLastId = sPathsToIds.size();
-        for (Hash<Path, uint32_t>::const_iterator it = sPathsToIds.begin(); it != sPathsToIds.end(); ++it) {
-            assert(it->second <= it->second);
-            sIdsToPaths[it->second] = it->first;
-        }
-    }
+    static Hash<uint32_t, Path> idsToPaths();
+    static Hash<Path, uint32_t> pathsToIds();
+    // must be called before any other thread uses the table
+    static void init(const Hash<Path, uint32_t> &pathsToIds);
+    // ids are handed out sequentially so the paths created after a given
+    // id are simply the ones with higher ids
+    static List<Path> pathsSince(uint32_t id, uint32_t *lastId);
+    // the highest id the table can hold
+    static uint32_t maxFileId();
 private:
-    static Hash<Path, uint32_t> sPathsToIds;
-    static Hash<uint32_t, Path> sIdsToPaths;
-    static uint32_t sLastId;
-    static std::mutex sMutex;
-    mutable Path mCachedPath;
+    static String context(const Path &path, uint32_t offset, int *column);
+    static bool convertOffset(const Path &path, uint32_t offset, int &line, int &col);
 };
 
 template <> inline int fixedSize(const Location &)
@@ -270,6 +233,88 @@ template <> inline Deserializer &operator>>(Deserializer &s, Location &t)
     return s;
 }
 
+// Sets of locations are written in order with the fileId only when it
+// changes and the offset relative to the previous one in the same file. Both
+// are varints so most locations end up taking two or three bytes instead of
+// eight. The fileId is written as fileId + 1, 0 means the same file as the
+// previous location, so null locations round-trip too.
+static inline void writeVarint(Serializer &s, uint32_t value)
+{
+    char buf[5];
+    int len = 0;
+    while (value >= 0x80) {
+        buf[len++] = static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = static_cast<char>(value);
+    s.write(buf, len);
+}
+
+static inline uint32_t readVarint(Deserializer &s)
+{
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        unsigned char byte = 0;
+        s.read(reinterpret_cast<char*>(&byte), 1);
+        value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+// T is any sorted container of locations
+template <typename T>
+inline void writeLocations(Serializer &s, const T &locations)
+{
+    writeVarint(s, locations.size());
+    uint32_t marker = 0, offset = 0;
+    for (typename T::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        if (it->fileId() + 1 != marker) {
+            marker = it->fileId() + 1;
+            offset = 0;
+            writeVarint(s, marker);
+        } else {
+            writeVarint(s, 0);
+        }
+        writeVarint(s, it->offset() - offset);
+        offset = it->offset();
+    }
+}
+
+// fileId and offset carry the previous location over to the next call
+static inline Location readLocation(Deserializer &s, uint32_t &fileId, uint32_t &offset)
+{
+    if (const uint32_t marker = readVarint(s)) {
+        fileId = marker - 1;
+        offset = 0;
+    }
+    offset += readVarint(s);
+    return Location(fileId, offset);
+}
+
+template <typename T>
+inline void readLocations(Deserializer &s, T &locations)
+{
+    locations.clear();
+    const uint32_t count = readVarint(s);
+    uint32_t fileId = 0, offset = 0;
+    for (uint32_t i=0; i<count; ++i)
+        locations.insert(locations.end(), readLocation(s, fileId, offset));
+}
+
+inline Serializer &operator<<(Serializer &s, const Set<Location> &locations)
+{
+    writeLocations(s, locations);
+    return s;
+}
+
+inline Deserializer &operator>>(Deserializer &s, Set<Location> &locations)
+{
+    readLocations(s, locations);
+    return s;
+}
+
 static inline Log operator<<(Log dbg, const Location &loc)
 {
     const String out = "Location(" + loc.key() + ")";
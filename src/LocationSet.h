@@ -0,0 +1,252 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef LocationSet_h
+#define LocationSet_h
+
+#include "Location.h"
+#include <rct/Log.h>
+#include <rct/Serializer.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+// Sorted array of locations used for the targets and references of a
+// CursorInfo. Most cursors have at most a couple of each so the first
+// InlineCapacity locations are stored in the object itself and only larger
+// sets allocate. Locations are plain 64-bit values and are moved around
+// with memcpy/memmove.
+class LocationSet
+{
+public:
+    typedef const Location *const_iterator;
+    typedef const Location *iterator;
+
+    LocationSet()
+        : mSize(0), mCapacity(InlineCapacity)
+    {}
+    LocationSet(const LocationSet &other)
+        : mSize(0), mCapacity(InlineCapacity)
+    {
+        *this = other;
+    }
+    LocationSet(LocationSet &&other)
+        : mSize(0), mCapacity(InlineCapacity)
+    {
+        *this = std::move(other);
+    }
+    ~LocationSet()
+    {
+        if (isAllocated())
+            free(mHeap);
+    }
+
+    LocationSet &operator=(const LocationSet &other)
+    {
+        if (this != &other) {
+            mSize = 0;
+            reserve(other.mSize);
+            if (other.mSize)
+                memcpy(data(), other.data(), other.mSize * sizeof(Location));
+            mSize = other.mSize;
+        }
+        return *this;
+    }
+    LocationSet &operator=(LocationSet &&other)
+    {
+        if (this != &other) {
+            if (isAllocated())
+                free(mHeap);
+            mSize = other.mSize;
+            mCapacity = other.mCapacity;
+            if (other.isAllocated()) {
+                mHeap = other.mHeap;
+            } else if (mSize) {
+                memcpy(mInline, other.mInline, mSize * sizeof(Location));
+            }
+            other.mSize = 0;
+            other.mCapacity = InlineCapacity;
+        }
+        return *this;
+    }
+
+    int size() const { return mSize; }
+    bool isEmpty() const { return !mSize; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + mSize; }
+    const Location &first() const { assert(mSize); return data()[0]; }
+    const Location &last() const { assert(mSize); return data()[mSize - 1]; }
+
+    void clear()
+    {
+        if (isAllocated())
+            free(mHeap);
+        mSize = 0;
+        mCapacity = InlineCapacity;
+    }
+
+    bool contains(const Location &location) const
+    {
+        const_iterator it = std::lower_bound(begin(), end(), location);
+        return it != end() && *it == location;
+    }
+
+    bool insert(const Location &location)
+    {
+        // locations mostly arrive in order
+        if (!mSize || last() < location) {
+            reserve(mSize + 1);
+            data()[mSize++] = location;
+            return true;
+        }
+        const int idx = std::lower_bound(begin(), end(), location) - begin();
+        if (data()[idx] == location)
+            return false;
+        reserve(mSize + 1);
+        Location *d = data();
+        memmove(d + idx + 1, d + idx, (mSize - idx) * sizeof(Location));
+        d[idx] = location;
+        ++mSize;
+        return true;
+    }
+
+    bool remove(const Location &location)
+    {
+        const int idx = std::lower_bound(begin(), end(), location) - begin();
+        if (idx == static_cast<int>(mSize) || !(data()[idx] == location))
+            return false;
+        Location *d = data();
+        memmove(d + idx, d + idx + 1, (mSize - idx - 1) * sizeof(Location));
+        --mSize;
+        return true;
+    }
+
+    // removes every location for which pred returns true, returns the
+    // number of locations removed
+    template <typename Predicate>
+    int removeIf(Predicate pred)
+    {
+        Location *d = data();
+        const int removed = (d + mSize) - std::remove_if(d, d + mSize, pred);
+        mSize -= removed;
+        return removed;
+    }
+
+    // merges the two sorted arrays in one pass rather than inserting one
+    // location at a time
+    void unite(const LocationSet &other, int *count = 0)
+    {
+        int added = 0;
+        if (other.isEmpty() || this == &other) {
+            // nothing to add
+        } else if (isEmpty()) {
+            *this = other;
+            added = mSize;
+        } else if (last() < other.first()) {
+            reserve(mSize + other.mSize);
+            memcpy(data() + mSize, other.data(), other.mSize * sizeof(Location));
+            mSize += other.mSize;
+            added = other.mSize;
+        } else {
+            const uint32_t capacity = mSize + other.mSize;
+            Location *merged = static_cast<Location*>(malloc(capacity * sizeof(Location)));
+            const uint32_t size = std::set_union(begin(), end(), other.begin(), other.end(), merged) - merged;
+            added = size - mSize;
+            if (!added) {
+                free(merged);
+            } else if (!isAllocated() && size <= InlineCapacity) {
+                memcpy(mInline, merged, size * sizeof(Location));
+                mSize = size;
+                free(merged);
+            } else {
+                if (isAllocated())
+                    free(mHeap);
+                mHeap = merged;
+                mCapacity = std::max<uint32_t>(capacity, InlineCapacity + 1);
+                mSize = size;
+            }
+        }
+        if (count)
+            *count = added;
+    }
+
+    // heap memory in addition to sizeof(LocationSet)
+    size_t memoryUsage() const { return isAllocated() ? mCapacity * sizeof(Location) : 0; }
+
+    bool operator==(const LocationSet &other) const
+    {
+        return mSize == other.mSize && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const LocationSet &other) const { return !operator==(other); }
+private:
+    enum { InlineCapacity = 2 };
+
+    bool isAllocated() const { return mCapacity > InlineCapacity; }
+    Location *data() { return isAllocated() ? mHeap : mInline; }
+    const Location *data() const { return isAllocated() ? mHeap : mInline; }
+
+    void reserve(uint32_t size)
+    {
+        if (size <= mCapacity)
+            return;
+        const uint32_t capacity = std::max(size, mCapacity * 2);
+        if (isAllocated()) {
+            mHeap = static_cast<Location*>(realloc(mHeap, capacity * sizeof(Location)));
+        } else {
+            Location *heap = static_cast<Location*>(malloc(capacity * sizeof(Location)));
+            if (mSize)
+                memcpy(heap, mInline, mSize * sizeof(Location));
+            mHeap = heap;
+        }
+        mCapacity = capacity;
+    }
+
+    uint32_t mSize, mCapacity;
+    union {
+        Location mInline[InlineCapacity];
+        Location *mHeap;
+    };
+};
+
+static inline Log operator<<(Log dbg, const LocationSet &locations)
+{
+    String out = "LocationSet(";
+    for (LocationSet::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        if (it != locations.begin())
+            out += ", ";
+        out += it->key();
+    }
+    out += ")";
+    return (dbg << out);
+}
+
+// same format as Set<Location>
+inline Serializer &operator<<(Serializer &s, const LocationSet &locations)
+{
+    writeLocations(s, locations);
+    return s;
+}
+
+inline Deserializer &operator>>(Deserializer &s, LocationSet &locations)
+{
+    locations.clear();
+    const uint32_t count = readVarint(s);
+    uint32_t fileId = 0, offset = 0;
+    for (uint32_t i=0; i<count; ++i)
+        locations.insert(readLocation(s, fileId, offset));
+    return s;
+}
+
+#endif
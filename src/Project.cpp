@@ -14,7 +14,12 @@ You should have received a copy of the GNU General Public License
 along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include "Project.h"
+#include "DataFile.h"
 #include "FileManager.h"
+#include "FileSymbols.h"
+#include "ReferenceGraph.h"
+#include "SymbolNameIndex.h"
+#include "FileCache.h"
 #include "IndexerJob.h"
 #include <rct/Rct.h>
 #include <rct/Log.h>
@@ -29,15 +34,49 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "ValidateDBJob.h"
 #include "IndexerJobClang.h"
 #include "ReparseJob.h"
+#include "SystemIndex.h"
 #include <math.h>
+#include <unistd.h>
 
 static void *ModifiedFiles = &ModifiedFiles;
 static void *Sync = &Sync;
 
 enum {
-    SyncTimeout = 500
+    SyncTimeout = 500,
+    JournalCompactionRatio = 2 // compact when the journal is larger than half the database
 };
 
+// Symbols, symbol names and usrs are sharded by the fileId of the
+// locations they describe so that only shards for files that were touched
+// since the last save have to be serialized again.
+enum Section {
+    Section_Symbols = 1,
+    Section_SymbolNames,
+    Section_Usr,
+    Section_Dependencies,
+    Section_Sources,
+    Section_VisitedFiles,
+    Section_Shards,
+    Section_SystemFiles
+};
+
+static inline uint64_t sectionId(Section section, uint32_t fileId = 0)
+{
+    return (static_cast<uint64_t>(section) << 32) | fileId;
+}
+
+static inline Path projectFile(const Path &path)
+{
+    Path encoded = path;
+    RTags::encodePath(encoded);
+    return Server::instance()->options().dataDir + encoded;
+}
+
+static inline Path journalFile(const Path &path)
+{
+    return projectFile(path) + ".journal";
+}
+
 class RestoreThread : public Thread
 {
 public:
@@ -50,8 +89,12 @@ public:
     virtual void run()
     {
         if (std::shared_ptr<Project> project = mProject.lock()) {
-            project->restore();
-            EventLoop::mainEventLoop()->callLater(std::bind(&Project::startPendingJobs, project.get()));
+            Set<uint32_t> dirty;
+            bool needsSave = false;
+            project->restore(dirty, needsSave);
+            // queries are served on the main thread while we restore so
+            // anything that modifies the maps has to happen there
+            EventLoop::mainEventLoop()->callLater(std::bind(&Project::startPendingJobs, project, dirty, needsSave));
         }
     }
 private:
@@ -59,7 +102,8 @@ private:
 };
 
 Project::Project(const Path &path)
-    : mPath(path), mState(Unloaded), mJobCounter(0)
+    : mPath(path), mState(Unloaded), mJobCounter(0), mPendingSections(0),
+      mJournalReplayPending(false), mJournalSize(0), mPostingsValid(false), mSaveRequested(false)
 {
     mWatcher.modified().connect(std::bind(&Project::onFileModified, this, std::placeholders::_1));
     mWatcher.removed().connect(std::bind(&Project::onFileModified, this, std::placeholders::_1));
@@ -85,121 +129,254 @@ void Project::init()
     fileManager->init(shared_from_this(), FileManager::Asynchronous);
 }
 
-bool Project::restore()
+bool Project::restore(Set<uint32_t> &dirty, bool &needsSave)
 {
-    bool needsSave = false;
     assert(state() == Loading);
     StopWatch timer;
-    Path path = mPath;
-    RTags::encodePath(path);
-    const Path p = Server::instance()->options().dataDir + path;
-    bool restoreError = false;
-    FILE *f = fopen(p.constData(), "r");
-    if (!f) {
+    const Path p = projectFile(mPath);
+    if (!p.isFile()) {
         std::lock_guard<std::mutex> lock(mMutex);
         mState = Loaded;
         return false;
     }
 
-    Deserializer in(f);
-    int version;
-    in >> version;
-    if (version != Server::DatabaseVersion) {
-        error("Wrong database version. Expected %d, got %d for %s. Removing.", Server::DatabaseVersion, version, p.constData());
-        restoreError = true;
-        goto end;
+    std::unique_ptr<DataFile> file(new DataFile(p));
+    if (!file->open(Server::DatabaseVersion)) {
+        error() << file->errorString() << "Removing.";
+        Path::rm(p);
+        Path::rm(journalFile(mPath));
+        return false;
+    }
+    DependencyMap dependencies;
+    SourceInformationMap sources;
+    Set<uint32_t> visitedFiles;
+    Set<uint64_t> shards;
+    Map<uint32_t, String> systemFileKeys;
+    if (!file->read(sectionId(Section_Dependencies), dependencies)
+        || !file->read(sectionId(Section_Sources), sources)
+        || !file->read(sectionId(Section_VisitedFiles), visitedFiles)
+        || !file->read(sectionId(Section_Shards), shards)
+        || !file->read(sectionId(Section_SystemFiles), systemFileKeys)) {
+        error("%s seems to be corrupted, refusing to restore %s",
+              p.constData(), mPath.constData());
+        Path::rm(p);
+        Path::rm(journalFile(mPath));
+        return false;
+    }
+
+    // Shards that are missing, or that were damaged and dropped when the
+    // file was recovered, are rebuilt by reindexing the files they belong
+    // to. Shards that fail their checksum later on are handled when they're
+    // loaded.
+    Set<uint32_t> damaged;
+    for (Set<uint64_t>::const_iterator it = shards.begin(); it != shards.end(); ++it) {
+        if (!file->hasSection(*it))
+            damaged.insert(static_cast<uint32_t>(*it));
     }
+    const bool recovered = file->isRecovered();
+
+    // Queries are served while we're still restoring. The symbol sections
+    // are published first since they're loaded on demand by whoever needs
+    // them, the rest is swapped in under the lock once it's decoded.
     {
-        int fs;
-        in >> fs;
-        if (fs != Rct::fileSize(f)) {
-            error("%s seems to be corrupted, refusing to restore %s",
-                  p.constData(), mPath.constData());
-            restoreError = true;
-            goto end;
-        }
+        std::lock_guard<std::mutex> lock(mSectionMutex);
+        mDataFile = std::move(file);
+        mPendingSections = AllSections;
+        mJournalReplayPending = journalFile(mPath).isFile();
     }
     {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDependencies = dependencies;
+        mSources = sources;
+        mVisitedFiles = std::move(visitedFiles);
+        mSystemFileKeys = std::move(systemFileKeys);
+        restoreJournal();
+        systemFileKeys = mSystemFileKeys;
+    }
 
-        in >> mSymbols >> mSymbolNames >> mUsr >> mDependencies >> mSources >> mVisitedFiles;
-
-        DependencyMap reversedDependencies;
-        Set<uint32_t> dirty;
-        // these dependencies are in the form of:
-        // Path.cpp: Path.h, String.h ...
-        // mDependencies are like this:
-        // Path.h: Path.cpp, Server.cpp ...
+    // The system headers are served by the indexes they came from, the
+    // ones that are gone are indexed again
+    Hash<uint32_t, std::shared_ptr<const SystemShard> > systemFiles;
+    Set<uint32_t> missingSystemFiles;
+    for (Map<uint32_t, String>::const_iterator it = systemFileKeys.begin(); it != systemFileKeys.end(); ++it) {
+        const std::shared_ptr<SystemIndex> index = Server::instance()->systemIndex(it->second);
+        std::shared_ptr<const SystemShard> shard;
+        if (index)
+            shard = index->shard(it->first);
+        if (shard) {
+            systemFiles[it->first] = shard;
+        } else {
+            missingSystemFiles.insert(it->first);
+        }
+    }
 
-        {
-            DependencyMap::iterator it = mDependencies.begin();
-            while (it != mDependencies.end()) {
-                const Path file = Location::path(it->first);
-                if (!file.exists()) {
-                    error() << "Dir doesn't exist" << it->first << Location::path(it->first);
-                    mDependencies.erase(it++);
-                    needsSave = true;
-                    continue;
-                }
-                watch(file);
-                for (Set<uint32_t>::const_iterator s = it->second.begin(); s != it->second.end(); ++s) {
-                    reversedDependencies[*s].insert(it->first);
-                }
-                ++it;
-            }
+    // The main thread may change mDependencies and mSources once they're
+    // published so we check our own copies, removals are applied under the
+    // lock.
+    DependencyMap reversedDependencies;
+    Set<uint32_t> missingDependencies, missingSources;
+    dirty = damaged;
+    dirty += missingSystemFiles;
+    // these dependencies are in the form of:
+    // Path.cpp: Path.h, String.h ...
+    // mDependencies are like this:
+    // Path.h: Path.cpp, Server.cpp ...
+
+    for (DependencyMap::const_iterator it = dependencies.begin(); it != dependencies.end(); ++it) {
+        const Path file = Location::path(it->first);
+        if (!file.exists()) {
+            error() << "Dir doesn't exist" << it->first << Location::path(it->first);
+            missingDependencies.insert(it->first);
+            continue;
         }
+        watch(file);
+        for (Set<uint32_t>::const_iterator s = it->second.begin(); s != it->second.end(); ++s) {
+            reversedDependencies[*s].insert(it->first);
+        }
+    }
 
-        SourceInformationMap::iterator it = mSources.begin();
-        while (it != mSources.end()) {
-            if (!it->second.sourceFile().isFile()) {
-                error() << it->second.sourceFile() << "seems to have disappeared";
-                dirty.insert(it->first);
-                mSources.erase(it++);
-                needsSave = true;
-            } else {
-                const time_t parsed = it->second.parsed;
-                // error() << "parsed" << String::formatTime(parsed, String::DateTime) << parsed << it->second.sourceFile;
-                if (mDependencies.value(it->first).contains(it->first)) {
-                    assert(mDependencies.value(it->first).contains(it->first));
-                    assert(mDependencies.contains(it->first));
-                    const Set<uint32_t> &deps = reversedDependencies[it->first];
-                    for (Set<uint32_t>::const_iterator d = deps.begin(); d != deps.end(); ++d) {
-                        if (!dirty.contains(*d) && Location::path(*d).lastModified() > parsed) {
-                            // error() << Location::path(*d).lastModified() << "is more than" << parsed;
-                            dirty.insert(*d);
-                        }
+    for (SourceInformationMap::const_iterator it = sources.begin(); it != sources.end(); ++it) {
+        if (!it->second.sourceFile().isFile()) {
+            error() << it->second.sourceFile() << "seems to have disappeared";
+            dirty.insert(it->first);
+            missingSources.insert(it->first);
+        } else {
+            const time_t parsed = it->second.parsed;
+            // error() << "parsed" << String::formatTime(parsed, String::DateTime) << parsed << it->second.sourceFile;
+            if (!missingDependencies.contains(it->first) && dependencies.value(it->first).contains(it->first)) {
+                assert(dependencies.contains(it->first));
+                const Set<uint32_t> &deps = reversedDependencies[it->first];
+                for (Set<uint32_t>::const_iterator d = deps.begin(); d != deps.end(); ++d) {
+                    if (!dirty.contains(*d) && Location::path(*d).lastModified() > parsed) {
+                        // error() << Location::path(*d).lastModified() << "is more than" << parsed;
+                        dirty.insert(*d);
                     }
                 }
-                ++it;
             }
         }
-        if (!dirty.isEmpty()) {
-            startDirtyJobs(dirty);
-        } else if (needsSave) {
-            save();
-        }
     }
-end:
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRestoredSystemFiles = std::move(systemFiles);
+        for (Set<uint32_t>::const_iterator it = missingSystemFiles.begin(); it != missingSystemFiles.end(); ++it)
+            mSystemFileKeys.remove(*it);
+    }
+    if (!missingDependencies.isEmpty() || !missingSources.isEmpty()) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (Set<uint32_t>::const_iterator it = missingDependencies.begin(); it != missingDependencies.end(); ++it)
+            mDependencies.remove(*it);
+        for (Set<uint32_t>::const_iterator it = missingSources.begin(); it != missingSources.end(); ++it)
+            mSources.remove(*it);
+        needsSave = true;
+    }
+    // a recovered file has no usable table, rewrite it right away
+    needsSave = recovered || (needsSave && dirty.isEmpty());
     // fileManager->jsFilesChanged().connect(this, &Project::onJSFilesAdded);
     // onJSFilesAdded();
-    fclose(f);
 
-    if (restoreError) {
-        Path::rm(p);
-    } else {
-        error() << "Restored project" << mPath << "in" << timer.elapsed() << "ms";
+    error() << "Restored project" << mPath << "in" << timer.elapsed() << "ms";
+    return true;
+}
+
+void Project::loadPendingSections(unsigned sections) const
+{
+    std::lock_guard<std::mutex> lock(mSectionMutex);
+    loadSectionsLocked(sections);
+}
+
+void Project::loadSectionsLocked(unsigned sections) const // mSectionMutex always held
+{
+    unsigned pending = mPendingSections & sections;
+    if (!pending)
+        return;
+    assert(mDataFile);
+    StopWatch timer;
+    Project *that = const_cast<Project*>(this);
+    if (pending & (SymbolsSection|SymbolNamesSection))
+        clearSymbolViews(pending);
+    that->mPostingsValid = false;
+    const List<uint64_t> ids = mDataFile->sections();
+    Set<uint32_t> damaged;
+    for (List<uint64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+        switch (static_cast<Section>(*it >> 32)) {
+        case Section_Symbols:
+            if (pending & SymbolsSection) {
+                SymbolMap shard;
+                if (mDataFile->read(*it, shard)) {
+                    that->mSymbols.insert(shard.begin(), shard.end());
+                } else {
+                    damaged.insert(static_cast<uint32_t>(*it));
+                }
+            }
+            break;
+        case Section_SymbolNames:
+            if (pending & SymbolNamesSection) {
+                SymbolNameMap shard;
+                if (mDataFile->read(*it, shard)) {
+                    for (SymbolNameMap::const_iterator s = shard.begin(); s != shard.end(); ++s)
+                        that->mSymbolNames[s->first].unite(s->second);
+                } else {
+                    damaged.insert(static_cast<uint32_t>(*it));
+                }
+            }
+            break;
+        case Section_Usr:
+            if (pending & UsrSection) {
+                UsrMap shard;
+                if (mDataFile->read(*it, shard)) {
+                    for (UsrMap::const_iterator u = shard.begin(); u != shard.end(); ++u)
+                        that->mUsr[u->first].unite(u->second);
+                } else {
+                    damaged.insert(static_cast<uint32_t>(*it));
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (!damaged.isEmpty()) {
+        // we may be on any thread and holding any lock here
+        error() << "Reindexing" << damaged.size() << "files with damaged shards in" << mPath;
+        EventLoop::mainEventLoop()->callLater(std::bind(&Project::startDirtyJobs, that->shared_from_this(), damaged));
     }
+    mPendingSections &= ~pending;
+    // mDataFile stays mapped so save() can copy untouched shards from it
+    warning() << "Loaded sections" << String::format<8>("0x%x", pending) << "for" << mPath
+              << "in" << timer.elapsed() << "ms";
+}
 
-    return !restoreError;
+// The journal is replayed on the main thread, it goes through dirty() and
+// the postings like any other sync. Until then queries see the database as
+// it was saved.
+void Project::replayPendingJournalLocked() // mSectionMutex always held
+{
+    if (!mJournalReplayPending)
+        return;
+    loadSectionsLocked(AllSections);
+    replayJournal();
+    mJournalReplayPending = false;
 }
 
-void Project::startPendingJobs() // lock always held
+void Project::startPendingJobs(const Set<uint32_t> &dirty, bool needsSave)
 {
+    {
+        // before the system headers are published, replaying a record
+        // that dirties one would drop it
+        std::lock_guard<std::mutex> lock(mSectionMutex);
+        replayPendingJournalLocked();
+    }
     Hash<Path, std::pair<Path, List<String> > > pendingCompiles;
     {
         std::lock_guard<std::mutex> lock(mMutex);
         mState = Loaded;
         pendingCompiles = std::move(mPendingCompiles);
+        mSystemFiles = std::move(mRestoredSystemFiles);
     }
+    if (!dirty.isEmpty())
+        startDirtyJobs(dirty);
+    if (needsSave)
+        save();
     for (Hash<Path, std::pair<Path, List<String> > >::const_iterator it = pendingCompiles.begin(); it != pendingCompiles.end(); ++it) {
         index(it->first, it->second.first, it->second.second);
     }
@@ -244,13 +421,34 @@ void Project::unload()
     mJobs.clear();
     fileManager.reset();
 
+    {
+        std::lock_guard<std::mutex> sectionLock(mSectionMutex);
+        mPendingSections = 0;
+        mDataFile.reset();
+        mJournalReplayPending = false;
+        mJournalSize = 0;
+        mDirtyShards.clear();
+    }
+    mSaveSnapshot.reset();
+    mSaveRequested = false;
+    if (mPendingImport) {
+        EventLoop::mainEventLoop()->callLater(std::bind(mImportFinished, false, String::format<128>("Import into %s was cancelled", mPath.constData())));
+        mPendingImport.reset();
+        mImportFinished = std::function<void(bool, const String &)>();
+    }
+    clearSymbolViews();
     mSymbols.clear();
     mErrorSymbols.clear();
     mSymbolNames.clear();
     mUsr.clear();
+    mPostings.clear();
+    mPostingsValid = false;
     mFiles.clear();
     mSources.clear();
     mVisitedFiles.clear();
+    mSystemFileKeys.clear();
+    mSystemFiles.clear();
+    mIndexSession.reset();
     mDependencies.clear();
     mPendingCompiles.clear();
     mPendingJobs.clear();
@@ -296,7 +494,9 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job)
 
         const uint32_t fileId = job->fileId();
         if (job->isAborted()) {
-            mVisitedFiles -= job->visitedFiles();
+            releaseFiles(job->visitedFiles());
+            if (std::shared_ptr<IndexData> data = job->data())
+                releaseFiles(data->sharedFiles);
             --mJobCounter;
             pending = mPendingJobs.take(fileId, &startPending);
             if (mJobs.value(fileId) == job)
@@ -319,7 +519,7 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job)
                                                                       std::static_pointer_cast<IndexerJobClang>(job)->contents(),
                                                                       shared_from_this()));
                         clangData->unit = 0;
-                        Server::instance()->startIndexerJob(rj);
+                        Server::instance()->startIndexerJob(rj, IndexerScheduler::CurrentFile);
                     } else {
                         addCachedUnit(sourceInfo.sourceFile(), sourceInfo.args, clangData->unit, 1);
                         clangData->unit = 0;
@@ -355,37 +555,383 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job)
         index(pending.source, pending.type);
 }
 
-bool Project::save()
+static inline void encodeSymbolShard(SymbolMap::const_iterator begin, SymbolMap::const_iterator end,
+                                     uint32_t fileId, List<std::pair<uint64_t, String> > &out)
 {
-    std::lock_guard<std::mutex> lock(mMutex);
-    if (!Server::instance()->saveFileIds())
-        return false;
+    SymbolMap shard;
+    shard.insert(begin, end);
+    String data;
+    {
+        Serializer serializer(data);
+        serializer << shard;
+    }
+    out.append(std::make_pair(sectionId(Section_Symbols, fileId), data));
+}
 
-    Path srcPath = mPath;
-    RTags::encodePath(srcPath);
-    const Server::Options &options = Server::instance()->options();
-    const Path p = options.dataDir + srcPath;
-    FILE *f = fopen(p.constData(), "w");
-    if (!f) {
-        error("Can't open file %s", p.constData());
-        return false;
+// Serializes the symbols of files, or of all files, one shard per file
+static inline void encodeSymbolShards(const SymbolMap &symbols, const Set<uint32_t> *files,
+                                      List<std::pair<uint64_t, String> > &out)
+{
+    if (files) {
+        for (Set<uint32_t>::const_iterator it = files->begin(); it != files->end(); ++it) {
+            const SymbolMap::const_iterator begin = symbols.lower_bound(Location(*it, 0));
+            const SymbolMap::const_iterator end = symbols.upper_bound(Location(*it, UINT32_MAX));
+            if (begin != end)
+                encodeSymbolShard(begin, end, *it, out);
+        }
+        return;
     }
-    Serializer out(f);
-    out << static_cast<int>(Server::DatabaseVersion);
-    const int pos = ftell(f);
-    out << static_cast<int>(0) << mSymbols << mSymbolNames << mUsr
-        << mDependencies << mSources << mVisitedFiles;
+    SymbolMap::const_iterator it = symbols.begin();
+    while (it != symbols.end()) {
+        const uint32_t fileId = it->first.fileId();
+        const SymbolMap::const_iterator next = symbols.upper_bound(Location(fileId, UINT32_MAX));
+        encodeSymbolShard(it, next, fileId, out);
+        it = next;
+    }
+}
 
-    const int size = ftell(f);
-    fseek(f, pos, SEEK_SET);
-    out << size;
+// The locations of a Set<Location> that are in the same file, written like
+// a Set<Location> of their own
+class LocationRun
+{
+public:
+    typedef Set<Location>::const_iterator const_iterator;
+    LocationRun(const_iterator begin, const_iterator end, int size)
+        : mBegin(begin), mEnd(end), mSize(size)
+    {}
+    int size() const { return mSize; }
+    const_iterator begin() const { return mBegin; }
+    const_iterator end() const { return mEnd; }
+private:
+    const const_iterator mBegin, mEnd;
+    const int mSize;
+};
 
-    fclose(f);
+template <typename T, typename Visitor>
+static inline void visitLocationRuns(const T &map, const Set<uint32_t> *files, Visitor visit)
+{
+    for (typename T::const_iterator it = map.begin(); it != map.end(); ++it) {
+        Set<Location>::const_iterator l = it->second.begin();
+        while (l != it->second.end()) {
+            const uint32_t fileId = l->fileId();
+            Set<Location>::const_iterator end = l;
+            int size = 0;
+            do {
+                ++end;
+                ++size;
+            } while (end != it->second.end() && end->fileId() == fileId);
+            if (!files || files->contains(fileId))
+                visit(it->first, fileId, LocationRun(l, end, size));
+            l = end;
+        }
+    }
+}
+
+// Serializes the entries of a SymbolNameMap or UsrMap into one shard per
+// file, each the same as a map of the entries with locations in that file.
+// The shards are written straight from map rather than split into maps of
+// their own first.
+template <typename T>
+static inline void encodeLocationShards(const T &map, Section section, const Set<uint32_t> *files,
+                                        List<std::pair<uint64_t, String> > &out)
+{
+    typedef typename T::key_type Key;
+    Hash<uint32_t, int> counts;
+    visitLocationRuns(map, files, [&counts](const Key &, uint32_t fileId, const LocationRun &) {
+            ++counts[fileId];
+        });
+    Hash<uint32_t, String> shards;
+    for (Hash<uint32_t, int>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+        Serializer serializer(shards[it->first]);
+        serializer << it->second;
+    }
+    visitLocationRuns(map, files, [&shards](const Key &key, uint32_t fileId, const LocationRun &run) {
+            Serializer serializer(shards[fileId]);
+            serializer << key;
+            writeLocations(serializer, run);
+        });
+    for (Hash<uint32_t, String>::const_iterator it = shards.begin(); it != shards.end(); ++it)
+        out.append(std::make_pair(sectionId(section, it->first), it->second));
+}
+
+static inline SymbolNameMap::const_iterator findPosting(const SymbolNameMap &, SymbolNameMap::iterator name)
+{
+    return name;
+}
+
+static inline UsrMap::const_iterator findPosting(const UsrMap &usrs, uint64_t usr)
+{
+    return usrs.find(usr);
+}
+
+// Same shards as above for just the given files. The postings list what
+// each file contributed to so only those entries are visited, a posting
+// can be listed more than once or no longer have locations in the file.
+template <typename T, typename Key>
+static inline void encodeLocationShards(const T &map, Section section, const Set<uint32_t> &files,
+                                        const PostingsMap &postings, List<Key> FilePostings::*list,
+                                        List<std::pair<uint64_t, String> > &out)
+{
+    for (Set<uint32_t>::const_iterator file = files.begin(); file != files.end(); ++file) {
+        const PostingsMap::const_iterator p = postings.find(*file);
+        if (p == postings.end())
+            continue;
+        const List<Key> &keys = p->second.*list;
+        Set<const typename T::value_type*> seen;
+        String entries;
+        int count = 0;
+        {
+            Serializer serializer(entries);
+            for (typename List<Key>::const_iterator k = keys.begin(); k != keys.end(); ++k) {
+                const typename T::const_iterator it = findPosting(map, *k);
+                if (it == map.end() || !seen.insert(&*it))
+                    continue;
+                const Set<Location>::const_iterator begin = it->second.lower_bound(Location(*file, 0));
+                const Set<Location>::const_iterator end = it->second.upper_bound(Location(*file, UINT32_MAX));
+                if (begin == end)
+                    continue;
+                serializer << it->first;
+                writeLocations(serializer, LocationRun(begin, end, std::distance(begin, end)));
+                ++count;
+            }
+        }
+        if (!count)
+            continue;
+        String data;
+        {
+            Serializer serializer(data);
+            serializer << count;
+        }
+        data += entries;
+        out.append(std::make_pair(sectionId(section, *file), data));
+    }
+}
+
+// Saves of the same database take turns. A snapshot of a project that was
+// unloaded can still be writing when the project is saved again, the older
+// snapshot is dropped if the newer one got there first.
+struct SaveLock
+{
+    SaveLock()
+        : sequence(0), written(0)
+    {}
+    std::mutex mutex;
+    std::atomic<uint64_t> sequence;
+    uint64_t written; // protected by mutex
+};
+
+static std::shared_ptr<SaveLock> saveLock(const Path &path)
+{
+    static std::mutex mutex;
+    static Hash<Path, std::shared_ptr<SaveLock> > locks;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<SaveLock> &ret = locks[path];
+    if (!ret)
+        ret.reset(new SaveLock);
+    return ret;
+}
+
+// Everything that changed since the last save. The dirty shards are
+// serialized up front, shards that didn't change are copied straight from
+// the old file which stays mapped for as long as the snapshot is alive.
+struct SaveSnapshot
+{
+    Path path;
+    std::shared_ptr<SaveLock> lock;
+    uint64_t sequence;
+    std::shared_ptr<DataFile> base;
+    List<uint64_t> rawSections;
+    List<std::pair<uint64_t, String> > sections;
+    Set<uint32_t> dirtyShards;
+    DependencyMap dependencies;
+    SourceInformationMap sources;
+    Set<uint32_t> visitedFiles;
+    Map<uint32_t, String> systemFiles;
+    Set<uint32_t> damaged; // shards that failed their checksum
+    uint64_t journalSize;
+    int lockTime, encodeTime, writeTime;
+
+    bool write()
+    {
+        std::lock_guard<std::mutex> guard(lock->mutex);
+        if (sequence < lock->written)
+            return false;
+        DataFileWriter out(path);
+        if (!out.open(Server::DatabaseVersion))
+            return false;
+        Set<uint64_t> shards;
+        for (List<uint64_t>::const_iterator it = rawSections.begin(); it != rawSections.end(); ++it)
+            shards.insert(*it);
+        for (List<std::pair<uint64_t, String> >::const_iterator it = sections.begin(); it != sections.end(); ++it)
+            shards.insert(it->first);
+
+        // the eager sections go first so a truncated file only loses shards
+        // which can be rebuilt by reindexing the files they belong to
+        out.write(sectionId(Section_Dependencies), dependencies);
+        out.write(sectionId(Section_Sources), sources);
+        out.write(sectionId(Section_VisitedFiles), visitedFiles);
+        out.write(sectionId(Section_Shards), shards);
+        out.write(sectionId(Section_SystemFiles), systemFiles);
+        for (List<uint64_t>::const_iterator it = rawSections.begin(); it != rawSections.end(); ++it) {
+            if (!out.copySection(*base, *it))
+                damaged.insert(static_cast<uint32_t>(*it));
+        }
+        for (List<std::pair<uint64_t, String> >::const_iterator it = sections.begin(); it != sections.end(); ++it)
+            out.writeRaw(it->first, it->second.constData(), it->second.size());
+        if (!out.commit())
+            return false;
+        lock->written = sequence;
+        return true;
+    }
+};
+
+class SaveThread : public Thread
+{
+public:
+    SaveThread(const std::shared_ptr<Project> &project, const std::shared_ptr<SaveSnapshot> &snapshot)
+        : mProject(project), mSnapshot(snapshot)
+    {
+        setAutoDelete(true);
+    }
+
+    virtual void run()
+    {
+        StopWatch timer;
+        const bool ok = mSnapshot->write();
+        mSnapshot->writeTime = timer.elapsed();
+        if (std::shared_ptr<Project> project = mProject.lock())
+            EventLoop::mainEventLoop()->callLater(std::bind(&Project::onSaveFinished, project, mSnapshot, ok));
+    }
+private:
+    std::weak_ptr<Project> mProject;
+    std::shared_ptr<SaveSnapshot> mSnapshot;
+};
+
+bool Project::save()
+{
+    StopWatch timer;
+    std::shared_ptr<SaveSnapshot> snapshot(new SaveSnapshot);
+    unsigned pending;
+    bool all;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mSaveSnapshot) {
+            // picked up when the current one is done
+            mSaveRequested = true;
+            return true;
+        }
+        if (!Server::instance()->saveFileIds())
+            return false;
+
+        snapshot->path = projectFile(mPath);
+        snapshot->lock = saveLock(snapshot->path);
+        snapshot->sequence = ++snapshot->lock->sequence;
+        std::lock_guard<std::mutex> sectionLock(mSectionMutex);
+        replayPendingJournalLocked();
+        pending = mPendingSections;
+        all = !mDataFile;
+        if (mDataFile) {
+            // shards that haven't been touched, or were never loaded, are
+            // copied straight from the old file
+            snapshot->base = mDataFile;
+            const List<uint64_t> ids = mDataFile->sections();
+            for (List<uint64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+                unsigned flag = 0;
+                switch (static_cast<Section>(*it >> 32)) {
+                case Section_Symbols: flag = SymbolsSection; break;
+                case Section_SymbolNames: flag = SymbolNamesSection; break;
+                case Section_Usr: flag = UsrSection; break;
+                default: break;
+                }
+                if (flag && (pending & flag || !mDirtyShards.contains(static_cast<uint32_t>(*it))))
+                    snapshot->rawSections.append(*it);
+            }
+        }
+        snapshot->dependencies = mDependencies;
+        snapshot->sources = mSources;
+        snapshot->visitedFiles = mVisitedFiles;
+        snapshot->systemFiles = mSystemFileKeys;
+        snapshot->journalSize = mJournalSize;
+        std::swap(snapshot->dirtyShards, mDirtyShards);
+        mSaveSnapshot = snapshot;
+    }
+    snapshot->lockTime = timer.restart();
+
+    // Only the main thread modifies the maps so they're serialized without
+    // holding the locks. Sections that aren't loaded are copied raw and
+    // aren't touched here.
+    const Set<uint32_t> *files = all ? 0 : &snapshot->dirtyShards;
+    if (!(pending & SymbolsSection))
+        encodeSymbolShards(mSymbols, files, snapshot->sections);
+    // the postings lead straight to the names and usrs of the dirty files,
+    // they're built once and kept up to date by the syncs after that
+    if (files && !pending && !mPostingsValid)
+        buildPostings();
+    if (!(pending & SymbolNamesSection)) {
+        if (files && mPostingsValid) {
+            encodeLocationShards(mSymbolNames, Section_SymbolNames, *files, mPostings,
+                                 &FilePostings::symbolNames, snapshot->sections);
+        } else {
+            encodeLocationShards(mSymbolNames, Section_SymbolNames, files, snapshot->sections);
+        }
+    }
+    if (!(pending & UsrSection)) {
+        if (files && mPostingsValid) {
+            encodeLocationShards(mUsr, Section_Usr, *files, mPostings, &FilePostings::usrs, snapshot->sections);
+        } else {
+            encodeLocationShards(mUsr, Section_Usr, files, snapshot->sections);
+        }
+    }
+    snapshot->encodeTime = timer.elapsed();
+
+    SaveThread *thread = new SaveThread(shared_from_this(), snapshot);
+    thread->start();
     return true;
 }
 
+void Project::onSaveFinished(const std::shared_ptr<SaveSnapshot> &snapshot, bool ok)
+{
+    bool saveAgain;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (snapshot != mSaveSnapshot) // unloaded in the meantime
+            return;
+        mSaveSnapshot.reset();
+        saveAgain = mSaveRequested;
+        mSaveRequested = false;
+
+        std::lock_guard<std::mutex> sectionLock(mSectionMutex);
+        if (!ok) {
+            // the old file is still there, write these again next time
+            mDirtyShards += snapshot->dirtyShards;
+        } else {
+            // everything in the journal up to the snapshot is part of the
+            // database now
+            trimJournal(snapshot->journalSize);
+            std::shared_ptr<DataFile> file(new DataFile(snapshot->path));
+            if (file->open(Server::DatabaseVersion)) {
+                mDataFile = file;
+            } else if (mDataFile) {
+                // the old mapping is still valid, pull in whatever we
+                // haven't loaded and write everything next time
+                error() << file->errorString();
+                loadSectionsLocked(AllSections);
+                mDataFile.reset();
+            }
+        }
+    }
+    error() << (ok ? "Saved" : "Failed to save") << mPath << "in" << snapshot->writeTime
+            << "ms, held the lock for" << snapshot->lockTime << "ms, serializing took"
+            << snapshot->encodeTime << "ms";
+    if (!snapshot->damaged.isEmpty())
+        startDirtyJobs(snapshot->damaged);
+    if (saveAgain)
+        save();
+}
+
 void Project::index(const SourceInformation &c, IndexerJob::Type type)
 {
+    const uint32_t currentFileId = Server::instance()->currentFileId();
     std::lock_guard<std::mutex> lock(mMutex);
     static const char *fileFilter = getenv("RTAGS_FILE_FILTER");
     if (fileFilter && !strstr(c.sourceFile().constData(), fileFilter))
@@ -417,7 +963,25 @@ void Project::index(const SourceInformation &c, IndexerJob::Type type)
     if (type != IndexerJob::Dump)
         job->finished().connect<EventLoop::Async>(std::bind(&Project::onJobFinished, this, std::placeholders::_1));
 
-    Server::instance()->startIndexerJob(job);
+    IndexerScheduler::Level level = IndexerScheduler::Makefile;
+    switch (type) {
+    case IndexerJob::Dirty: {
+        level = IndexerScheduler::Dirty;
+        if (c.fileId == currentFileId) {
+            level = IndexerScheduler::CurrentFile;
+        } else if (currentFileId) {
+            const DependencyMap::const_iterator it = mDependencies.find(currentFileId);
+            if (it != mDependencies.end() && it->second.contains(c.fileId))
+                level = IndexerScheduler::CurrentFile;
+        }
+        break; }
+    case IndexerJob::Makefile:
+        break;
+    case IndexerJob::Dump:
+        level = IndexerScheduler::Dump;
+        break;
+    }
+    Server::instance()->startIndexerJob(job, level);
 }
 
 static inline bool endsWith(const char *haystack, int haystackLen, const char *needle)
@@ -535,6 +1099,7 @@ bool Project::index(const Path &sourceFile, const Path &cc, const List<String> &
 
 void Project::onFileModified(const Path &file)
 {
+    FileCache::invalidate(file);
     const uint32_t fileId = Location::fileId(file);
     if (mSuspendedFiles.contains(fileId)) {
         warning() << file << "is suspended. Ignoring modification";
@@ -542,6 +1107,8 @@ void Project::onFileModified(const Path &file)
     }
     debug() << file << "was modified" << fileId;
     if (fileId) {
+        if (file.isSystem())
+            Server::instance()->removeSystemFile(fileId);
         Set<uint32_t> dirty;
         dirty.insert(fileId);
         startDirtyJobs(dirty);
@@ -652,9 +1219,30 @@ void Project::onValidateDBJobErrors(const Set<Location> &errors)
     mPreviousErrors = errors;
 }
 
+void Project::releaseFiles(const Set<uint32_t> &files) // lock always held
+{
+    const int count = mVisitedFiles.size();
+    mVisitedFiles -= files;
+    // A job of the current session could have skipped the bodies in these
+    // and claim them now, the jobs started after this use a new one
+    if (mVisitedFiles.size() != count)
+        mIndexSession.reset();
+}
+
+std::shared_ptr<IndexSession> Project::indexSession() const
+{
+    if (!(Server::instance()->options().options & Server::SkipParsedBodies))
+        return std::shared_ptr<IndexSession>();
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mIndexSession)
+        mIndexSession.reset(new IndexSession(Server::instance()->clangIndex()));
+    return mIndexSession;
+}
+
 void Project::startDirtyJobs(const Set<uint32_t> &dirty)
 {
     Set<uint32_t> dirtyFiles;
+    List<SourceInformation> sources;
     {
         std::lock_guard<std::mutex> lock(mMutex);
         for (Set<uint32_t>::const_iterator it = dirty.begin(); it != dirty.end(); ++it) {
@@ -663,90 +1251,269 @@ void Project::startDirtyJobs(const Set<uint32_t> &dirty)
             if (!deps.isEmpty())
                 dirtyFiles += deps;
         }
-        mVisitedFiles -= dirtyFiles;
-    }
-
-    bool indexed = false;
-    for (Set<uint32_t>::const_iterator it = dirtyFiles.begin(); it != dirtyFiles.end(); ++it) {
-        const SourceInformationMap::const_iterator found = mSources.find(*it);
-        if (found != mSources.end()) {
-            index(found->second, IndexerJob::Dirty);
-            indexed = true;
+        releaseFiles(dirtyFiles);
+        for (Set<uint32_t>::const_iterator it = dirtyFiles.begin(); it != dirtyFiles.end(); ++it) {
+            const SourceInformationMap::const_iterator found = mSources.find(*it);
+            if (found != mSources.end())
+                sources.append(found->second);
         }
     }
-    if (!indexed && !dirtyFiles.isEmpty()) {
-        RTags::dirtySymbols(mSymbols, dirtyFiles);
-        RTags::dirtySymbolNames(mSymbolNames, dirtyFiles);
-        RTags::dirtyUsr(mUsr, dirtyFiles);
+
+    for (List<SourceInformation>::const_iterator it = sources.begin(); it != sources.end(); ++it)
+        index(*it, IndexerJob::Dirty);
+    if (sources.isEmpty() && !dirtyFiles.isEmpty()) {
+        loadSections(AllSections);
+        dirty(dirtyFiles);
     } else {
         mPendingDirtyFiles += dirtyFiles;
     }
 }
 
-static inline void writeSymbolNames(const SymbolNameMap &symbolNames, SymbolNameMap &current)
+// Appends key to the postings of every file in locations
+template <typename Key, typename Locations>
+static inline void addPostings(PostingsMap *postings, List<Key> FilePostings::*list,
+                               const Key &key, const Locations &locations)
 {
-    SymbolNameMap::const_iterator it = symbolNames.begin();
-    const SymbolNameMap::const_iterator end = symbolNames.end();
-    while (it != end) {
-        Set<Location> &value = current[it->first];
-        value.unite(it->second);
-        ++it;
+    if (!postings)
+        return;
+    uint32_t last = 0;
+    for (typename Locations::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        if (it->fileId() != last) {
+            last = it->fileId();
+            ((*postings)[last].*list).append(key);
+        }
     }
 }
 
-static inline void joinCursors(SymbolMap &symbols, const Set<Location> &locations)
+// cursor has to be cleaned up when any other file it points into is dirtied
+template <typename Locations>
+static inline void addReferrers(PostingsMap *postings, const Location &cursor, const Locations &locations)
 {
-    for (Set<Location>::const_iterator it = locations.begin(); it != locations.end(); ++it) {
-        SymbolMap::iterator c = symbols.find(*it);
-        if (c != symbols.end()) {
-            CursorInfo &cursorInfo = c->second;
-            for (Set<Location>::const_iterator innerIt = locations.begin(); innerIt != locations.end(); ++innerIt) {
-                if (innerIt != it)
-                    cursorInfo.targets.insert(*innerIt);
-            }
-            // ### this is filthy, we could likely think of something better
+    if (!postings)
+        return;
+    uint32_t last = cursor.fileId();
+    for (typename Locations::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        if (it->fileId() != last) {
+            last = it->fileId();
+            if (last != cursor.fileId() && (*postings)[last].referrers.insert(cursor).second)
+                (*postings)[cursor.fileId()].referred.insert(last);
         }
     }
 }
 
-static inline void writeUsr(const UsrMap &usr, UsrMap &current, SymbolMap &symbols)
+template <typename T>
+static inline void removeLocations(T &locations, const Set<uint32_t> &fileIds)
 {
-    UsrMap::const_iterator it = usr.begin();
-    const UsrMap::const_iterator end = usr.end();
-    while (it != end) {
-        Set<Location> &value = current[it->first];
-        int count = 0;
-        value.unite(it->second, &count);
-        if (count && value.size() > 1)
-            joinCursors(symbols, value);
-        ++it;
+    typename T::iterator it = locations.begin();
+    while (it != locations.end()) {
+        if (fileIds.contains(it->fileId())) {
+            locations.erase(it++);
+        } else {
+            ++it;
+        }
     }
 }
 
-static inline void writeErrorSymbols(const SymbolMap &symbols, ErrorSymbolMap &errorSymbols, const Hash<uint32_t, int> &errors)
+static inline bool compareSymbolNames(const SymbolNameMap::iterator &l, const SymbolNameMap::iterator &r)
 {
-    for (Hash<uint32_t, int>::const_iterator it = errors.begin(); it != errors.end(); ++it) {
-        if (it->second) {
-            SymbolMap &symbolsForFile = errorSymbols[it->first];
-            if (symbolsForFile.isEmpty()) {
-                const Location loc(it->first, 0);
-                SymbolMap::const_iterator sit = symbols.lower_bound(loc);
-                while (sit != symbols.end() && sit->first.fileId() == it->first) {
-                    symbolsForFile[sit->first] = sit->second;
-                    ++sit;
+    return &l->first < &r->first;
+}
+
+void Project::buildPostings()
+{
+    StopWatch timer;
+    mPostings.clear();
+    for (SymbolMap::const_iterator it = mSymbols.begin(); it != mSymbols.end(); ++it) {
+        addReferrers(&mPostings, it->first, it->second.targets);
+        addReferrers(&mPostings, it->first, it->second.references);
+    }
+    for (SymbolNameMap::iterator it = mSymbolNames.begin(); it != mSymbolNames.end(); ++it)
+        addPostings(&mPostings, &FilePostings::symbolNames, it, it->second);
+    for (UsrMap::const_iterator it = mUsr.begin(); it != mUsr.end(); ++it)
+        addPostings(&mPostings, &FilePostings::usrs, it->first, it->second);
+    mPostingsValid = true;
+    warning() << "Built postings for" << mPostings.size() << "files in" << mPath
+              << "in" << timer.elapsed() << "ms";
+}
+
+// Only the cursors in the dirty files, the cursors pointing into them and
+// the names and usrs they contributed to are visited. A symbol name is only
+// erased once it has no locations left, at that point the postings of every
+// file that listed it have been dropped so no stale iterators remain.
+void Project::dirty(const Set<uint32_t> &fileIds)
+{
+    clearSymbolViews(SymbolsSection);
+    if (!mPostingsValid)
+        buildPostings();
+
+    Set<Location> referrers;
+    List<SymbolNameMap::iterator> symbolNames;
+    Set<uint64_t> usrs;
+    for (Set<uint32_t>::const_iterator it = fileIds.begin(); it != fileIds.end(); ++it) {
+        mSystemFiles.erase(*it);
+        mSymbols.erase(mSymbols.lower_bound(Location(*it, 0)), mSymbols.upper_bound(Location(*it, UINT32_MAX)));
+        const PostingsMap::iterator postings = mPostings.find(*it);
+        if (postings != mPostings.end()) {
+            const FilePostings &p = postings->second;
+            for (Set<uint32_t>::const_iterator r = p.referred.begin(); r != p.referred.end(); ++r) {
+                const PostingsMap::iterator other = mPostings.find(*r);
+                if (other != mPostings.end()) {
+                    Set<Location> &locations = other->second.referrers;
+                    locations.erase(locations.lower_bound(Location(*it, 0)), locations.upper_bound(Location(*it, UINT32_MAX)));
                 }
             }
-        } else {
-            errorSymbols.remove(it->first);
+            referrers.insert(p.referrers.begin(), p.referrers.end());
+            symbolNames.insert(symbolNames.end(), p.symbolNames.begin(), p.symbolNames.end());
+            usrs.insert(p.usrs.begin(), p.usrs.end());
+            mPostings.erase(postings);
         }
     }
-}
 
-static inline void writeSymbols(SymbolMap &symbols, SymbolMap &current)
-{
-    if (!symbols.isEmpty()) {
-        if (current.isEmpty()) {
+    for (Set<Location>::const_iterator it = referrers.begin(); it != referrers.end(); ++it) {
+        if (fileIds.contains(it->fileId()))
+            continue;
+        const SymbolMap::iterator cursor = mSymbols.find(*it);
+        if (cursor != mSymbols.end() && cursor->second.dirty(fileIds))
+            mDirtyShards.insert(it->fileId());
+    }
+
+    std::sort(symbolNames.begin(), symbolNames.end(), compareSymbolNames);
+    symbolNames.erase(std::unique(symbolNames.begin(), symbolNames.end()), symbolNames.end());
+    for (List<SymbolNameMap::iterator>::const_iterator it = symbolNames.begin(); it != symbolNames.end(); ++it) {
+        removeLocations((*it)->second, fileIds);
+        if ((*it)->second.isEmpty()) {
+            if (mSymbolNameIndex)
+                mSymbolNameIndex->remove(*it);
+            mSymbolNames.erase(*it);
+        }
+    }
+
+    for (Set<uint64_t>::const_iterator it = usrs.begin(); it != usrs.end(); ++it) {
+        const UsrMap::iterator usr = mUsr.find(*it);
+        if (usr != mUsr.end()) {
+            removeLocations(usr->second, fileIds);
+            if (usr->second.isEmpty())
+                mUsr.erase(usr);
+        }
+    }
+
+    mDirtyShards += fileIds;
+}
+
+static inline void markShard(Set<uint32_t> &shards, uint32_t fileId, uint32_t &last)
+{
+    if (fileId != last) {
+        shards.insert(fileId);
+        last = fileId;
+    }
+}
+
+static inline void writeSymbolNames(const SymbolNameMap &symbolNames, SymbolNameMap &current,
+                                    Set<uint32_t> &shards, PostingsMap *postings, SymbolNameIndex *index)
+{
+    uint32_t last = 0;
+    SymbolNameMap::const_iterator it = symbolNames.begin();
+    const SymbolNameMap::const_iterator end = symbolNames.end();
+    while (it != end) {
+        SymbolNameMap::iterator name = current.find(it->first);
+        if (name == current.end()) {
+            name = current.insert(std::make_pair(it->first, Set<Location>())).first;
+            if (index)
+                index->insert(name);
+        }
+        name->second.unite(it->second);
+        addPostings(postings, &FilePostings::symbolNames, name, it->second);
+        for (Set<Location>::const_iterator l = it->second.begin(); l != it->second.end(); ++l)
+            markShard(shards, l->fileId(), last);
+        ++it;
+    }
+    if (index)
+        index->commit();
+}
+
+static inline void joinCursors(SymbolMap &symbols, const Set<Location> &locations,
+                               Set<uint32_t> &shards, PostingsMap *postings)
+{
+    uint32_t last = 0;
+    for (Set<Location>::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        SymbolMap::iterator c = symbols.find(*it);
+        if (c != symbols.end()) {
+            CursorInfo &cursorInfo = c->second;
+            Set<Location> joined;
+            for (Set<Location>::const_iterator innerIt = locations.begin(); innerIt != locations.end(); ++innerIt) {
+                if (innerIt == it)
+                    continue;
+                const SymbolMap::const_iterator other = symbols.find(*innerIt);
+                if (other == symbols.end())
+                    continue;
+                if (!cursorInfo.isSameEntity(other->second)) {
+                    if (*it < *innerIt) // once per pair
+                        error() << "Not joining" << *it << "and" << *innerIt << "with the same usr hash";
+                    continue;
+                }
+                cursorInfo.targets.insert(*innerIt);
+                joined.insert(*innerIt);
+            }
+            if (!joined.isEmpty()) {
+                addReferrers(postings, *it, joined);
+                markShard(shards, it->fileId(), last);
+            }
+            // ### this is filthy, we could likely think of something better
+        }
+    }
+}
+
+static inline void writeUsr(const IndexUsrMap &usr, UsrMap &current, SymbolMap &symbols,
+                            Set<uint32_t> &shards, PostingsMap *postings)
+{
+    uint32_t last = 0;
+    IndexUsrMap::const_iterator it = usr.begin();
+    const IndexUsrMap::const_iterator end = usr.end();
+    while (it != end) {
+        Set<Location> &value = current[it->first];
+        const int oldSize = value.size();
+        value.insert(it->second.begin(), it->second.end());
+        if (value.size() != oldSize) {
+            for (ArenaSet<Location>::const_iterator l = it->second.begin(); l != it->second.end(); ++l)
+                markShard(shards, l->fileId(), last);
+            addPostings(postings, &FilePostings::usrs, it->first, it->second);
+            if (value.size() > 1)
+                joinCursors(symbols, value, shards, postings);
+        }
+        ++it;
+    }
+}
+
+static inline void writeErrorSymbols(const SymbolMap &symbols, ErrorSymbolMap &errorSymbols, const Hash<uint32_t, int> &errors)
+{
+    for (Hash<uint32_t, int>::const_iterator it = errors.begin(); it != errors.end(); ++it) {
+        if (it->second) {
+            SymbolMap &symbolsForFile = errorSymbols[it->first];
+            if (symbolsForFile.isEmpty()) {
+                const Location loc(it->first, 0);
+                SymbolMap::const_iterator sit = symbols.lower_bound(loc);
+                while (sit != symbols.end() && sit->first.fileId() == it->first) {
+                    symbolsForFile[sit->first] = sit->second;
+                    ++sit;
+                }
+            }
+        } else {
+            errorSymbols.remove(it->first);
+        }
+    }
+}
+
+static inline void writeSymbols(SymbolMap &symbols, SymbolMap &current, Set<uint32_t> &shards, PostingsMap *postings)
+{
+    if (!symbols.isEmpty()) {
+        uint32_t last = 0;
+        if (current.isEmpty()) {
             current = symbols;
+            for (SymbolMap::const_iterator it = symbols.begin(); it != symbols.end(); ++it) {
+                markShard(shards, it->first.fileId(), last);
+                addReferrers(postings, it->first, it->second.targets);
+                addReferrers(postings, it->first, it->second.references);
+            }
         } else {
             SymbolMap::iterator it = symbols.begin();
             const SymbolMap::iterator end = symbols.end();
@@ -757,25 +1524,115 @@ static inline void writeSymbols(SymbolMap &symbols, SymbolMap &current)
                 } else {
                     cur->second.unite(it->second);
                 }
+                markShard(shards, it->first.fileId(), last);
+                addReferrers(postings, it->first, it->second.targets);
+                addReferrers(postings, it->first, it->second.references);
                 ++it;
             }
         }
     }
 }
 
-static inline void writeReferences(const ReferenceMap &references, SymbolMap &symbols)
+static inline void writeReferences(const IndexReferenceMap &references, SymbolMap &symbols,
+                                   Set<uint32_t> &shards, PostingsMap *postings)
+{
+    // group the references by target so each cursor's references are merged
+    // in one pass instead of being inserted into its sorted array one by one
+    List<std::pair<Location, Location> > refs;
+    const IndexReferenceMap::const_iterator end = references.end();
+    for (IndexReferenceMap::const_iterator it = references.begin(); it != end; ++it) {
+        for (ArenaSet<Location>::const_iterator rit = it->second.begin(); rit != it->second.end(); ++rit)
+            refs.append(std::make_pair(*rit, it->first));
+    }
+    std::sort(refs.begin(), refs.end());
+
+    uint32_t last = 0;
+    int i = 0;
+    while (i < refs.size()) {
+        const Location target = refs.at(i).first;
+        LocationSet locations;
+        do {
+            locations.insert(refs.at(i).second);
+        } while (++i < refs.size() && refs.at(i).first == target);
+        symbols[target].references.unite(locations);
+        markShard(shards, target.fileId(), last);
+        addReferrers(postings, target, locations);
+    }
+}
+
+// The headers of data that are served by its system index are dropped from
+// it, they're looked up in the index when the project is queried. What's
+// left are the project's own files and the references from them into the
+// headers.
+void Project::addSystemFiles(IndexData &data, Set<uint32_t> &missing)
+{
+    const String &key = data.systemIndex->key();
+    Set<uint32_t> served;
+    Set<uint32_t> files = data.systemFiles;
+    files += data.sharedFiles;
+    for (Set<uint32_t>::const_iterator it = files.begin(); it != files.end(); ++it) {
+        if (const std::shared_ptr<const SystemShard> shard = data.systemIndex->shard(*it)) {
+            mSystemFiles[*it] = shard;
+            served.insert(*it);
+        } else if (data.sharedFiles.contains(*it)) {
+            // removed from the index in the meantime
+            missing.insert(*it);
+        }
+    }
+    if (served.isEmpty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (Set<uint32_t>::const_iterator it = served.begin(); it != served.end(); ++it)
+            mSystemFileKeys[*it] = key;
+    }
+    for (Set<uint32_t>::const_iterator it = served.begin(); it != served.end(); ++it) {
+        data.symbols.erase(data.symbols.lower_bound(Location(*it, 0)), data.symbols.upper_bound(Location(*it, UINT32_MAX)));
+        data.references.erase(data.references.lower_bound(Location(*it, 0)), data.references.upper_bound(Location(*it, UINT32_MAX)));
+    }
+    for (SymbolNameMap::iterator it = data.symbolNames.begin(); it != data.symbolNames.end(); ) {
+        removeLocations(it->second, served);
+        if (it->second.isEmpty()) {
+            data.symbolNames.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    for (IndexUsrMap::iterator it = data.usrMap.begin(); it != data.usrMap.end(); ) {
+        removeLocations(it->second, served);
+        if (it->second.isEmpty()) {
+            data.usrMap.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// writeReferences() leaves a cursor with only the project's references at
+// each location they point to. Those in served headers get the rest of the
+// cursor from the index so targets resolve without going there.
+void Project::completeSystemCursors(const IndexReferenceMap &references, PostingsMap *postings)
 {
-    const ReferenceMap::const_iterator end = references.end();
-    for (ReferenceMap::const_iterator it = references.begin(); it != end; ++it) {
-        const Set<Location> &refs = it->second;
-        for (Set<Location>::const_iterator rit = refs.begin(); rit != refs.end(); ++rit) {
-            CursorInfo &ci = symbols[*rit];
-            ci.references.insert(it->first);
+    for (IndexReferenceMap::const_iterator it = references.begin(); it != references.end(); ++it) {
+        for (ArenaSet<Location>::const_iterator t = it->second.begin(); t != it->second.end(); ++t) {
+            const std::shared_ptr<const SystemShard> shard = mSystemFiles.value(t->fileId());
+            if (!shard)
+                continue;
+            const SymbolMap::iterator cursor = mSymbols.find(*t);
+            if (cursor == mSymbols.end() || cursor->second.symbolLength)
+                continue;
+            const SymbolMap::const_iterator found = shard->symbols.find(*t);
+            if (found == shard->symbols.end())
+                continue;
+            CursorInfo info = found->second;
+            info.references.clear();
+            cursor->second.unite(info);
+            addReferrers(postings, *t, info.targets);
         }
     }
 }
 
-void Project::syncDB(int *dirty, int *sync)
+void Project::syncDB(int *dirty, int *sync, String *journal)
 {
     StopWatch sw;
     if (mPendingDirtyFiles.isEmpty() && mPendingData.isEmpty()) {
@@ -786,29 +1643,56 @@ void Project::syncDB(int *dirty, int *sync)
     // for (Hash<uint32_t, std::shared_ptr<IndexData> >::iterator it = mPendingData.begin(); it != mPendingData.end(); ++it) {
     //     writeErrorSymbols(mSymbols, mErrorSymbols, it->second->errors);
     // }
+    loadSections(AllSections);
+    clearSymbolViews(SymbolsSection);
 
+    Set<uint32_t> dirtyFiles;
     if (!mPendingDirtyFiles.isEmpty()) {
-        RTags::dirtySymbols(mSymbols, mPendingDirtyFiles);
-        RTags::dirtySymbolNames(mSymbolNames, mPendingDirtyFiles);
-        RTags::dirtyUsr(mUsr, mPendingDirtyFiles);
-        mPendingDirtyFiles.clear();
+        this->dirty(mPendingDirtyFiles);
+        std::swap(dirtyFiles, mPendingDirtyFiles);
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (Set<uint32_t>::const_iterator it = dirtyFiles.begin(); it != dirtyFiles.end(); ++it)
+            mSystemFileKeys.remove(*it);
     }
     *dirty = sw.restart();
 
-    Set<uint32_t> newFiles;
+    Set<uint32_t> newFiles, missingSharedFiles;
+    bool systemIndexChanged = false;
     for (Hash<uint32_t, std::shared_ptr<IndexData> >::iterator it = mPendingData.begin(); it != mPendingData.end(); ++it) {
         const std::shared_ptr<IndexData> &data = it->second;
+        if (data->systemIndex) {
+            if (!data->systemFiles.isEmpty()) {
+                data->systemIndex->add(data->systemFiles, *data);
+                systemIndexChanged = true;
+            }
+            addSystemFiles(*data, missingSharedFiles);
+        }
         addDependencies(data->dependencies, newFiles);
         addFixIts(data->dependencies, data->fixIts);
-        writeSymbols(data->symbols, mSymbols);
-        writeUsr(data->usrMap, mUsr, mSymbols);
-        writeReferences(data->references, mSymbols);
-        writeSymbolNames(data->symbolNames, mSymbolNames);
+        PostingsMap *postings = mPostingsValid ? &mPostings : 0;
+        writeSymbols(data->symbols, mSymbols, mDirtyShards, postings);
+        writeUsr(data->usrMap, mUsr, mSymbols, mDirtyShards, postings);
+        writeReferences(data->references, mSymbols, mDirtyShards, postings);
+        writeSymbolNames(data->symbolNames, mSymbolNames, mDirtyShards, postings, mSymbolNameIndex.get());
+        if (!mSystemFiles.isEmpty())
+            completeSystemCursors(data->references, postings);
     }
     for (Set<uint32_t>::const_iterator it = newFiles.begin(); it != newFiles.end(); ++it) {
         watch(Location::path(*it));
     }
+    if (journal)
+        writeJournalRecord(dirtyFiles, *journal);
     mPendingData.clear();
+    if (systemIndexChanged)
+        Server::instance()->systemIndexChanged();
+    if (!missingSharedFiles.isEmpty()) {
+        // removed from the system index in the meantime, index them here
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            releaseFiles(missingSharedFiles);
+        }
+        startDirtyJobs(missingSharedFiles);
+    }
     if (Server::instance()->options().options & Server::Validate) {
         std::shared_ptr<ValidateDBJob> validate(new ValidateDBJob(shared_from_this(), mPreviousErrors));
         Server::instance()->startQueryJob(validate);
@@ -816,8 +1700,589 @@ void Project::syncDB(int *dirty, int *sync)
     *sync = sw.elapsed();
 }
 
+// Each sync appends one record to the journal:
+//
+// uint64_t eagerSize
+// uint64_t lazySize
+// eager: dirty files, removed sources, sources, visited files, dependencies
+// lazy: dirty files, count, count * { symbols, symbolNames, usrs, references }
+//
+// The eager part is applied during restore, the lazy part when the symbol
+// sections are loaded. Replaying a record twice is harmless so a crash
+// between writing the database and removing the journal is fine.
+void Project::writeJournalRecord(const Set<uint32_t> &dirty, String &out) const
+{
+    String eager, lazy;
+    {
+        Set<uint32_t> removedSources, visited;
+        SourceInformationMap sources;
+        DependencyMap dependencies;
+        Map<uint32_t, String> systemFiles;
+        for (Set<uint32_t>::const_iterator it = dirty.begin(); it != dirty.end(); ++it) {
+            if (!mSources.contains(*it))
+                removedSources.insert(*it);
+        }
+        for (Hash<uint32_t, std::shared_ptr<IndexData> >::const_iterator it = mPendingData.begin(); it != mPendingData.end(); ++it) {
+            const SourceInformationMap::const_iterator source = mSources.find(it->first);
+            if (source != mSources.end())
+                sources[it->first] = source->second;
+            const DependencyMap &deps = it->second->dependencies;
+            for (DependencyMap::const_iterator d = deps.begin(); d != deps.end(); ++d) {
+                dependencies[d->first].unite(d->second);
+                if (mVisitedFiles.contains(d->first))
+                    visited.insert(d->first);
+                const String key = mSystemFileKeys.value(d->first);
+                if (!key.isEmpty())
+                    systemFiles[d->first] = key;
+            }
+        }
+        Serializer serializer(eager);
+        serializer << dirty << removedSources << sources << visited << dependencies << systemFiles;
+    }
+    {
+        Serializer serializer(lazy);
+        serializer << dirty << static_cast<int>(mPendingData.size());
+        for (Hash<uint32_t, std::shared_ptr<IndexData> >::const_iterator it = mPendingData.begin(); it != mPendingData.end(); ++it) {
+            const std::shared_ptr<IndexData> &data = it->second;
+            serializer << data->symbols << data->symbolNames << data->usrMap << data->references;
+        }
+    }
+    const uint64_t sizes[] = { static_cast<uint64_t>(eager.size()), static_cast<uint64_t>(lazy.size()) };
+    out.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    out.append(eager);
+    out.append(lazy);
+}
+
+bool Project::appendJournal(const String &record)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!Server::instance()->saveFileIds())
+        return false;
+
+    const Path p = journalFile(mPath);
+    FILE *f = fopen(p.constData(), "a");
+    if (!f) {
+        error("Can't open file %s", p.constData());
+        return false;
+    }
+    const bool ok = fwrite(record.constData(), record.size(), 1, f) == 1;
+    fclose(f);
+    if (!ok) {
+        error("Failed to write to %s", p.constData());
+        return false;
+    }
+    mJournalSize += record.size();
+    return true;
+}
+
+void Project::trimJournal(uint64_t size) // lock always held
+{
+    const Path p = journalFile(mPath);
+    if (size >= mJournalSize) {
+        Path::rm(p);
+        mJournalSize = 0;
+        return;
+    }
+    // records appended while the snapshot was being written have to stay
+    const String contents = p.readAll();
+    const Path tmp = p + ".tmp";
+    bool ok = false;
+    if (static_cast<uint64_t>(contents.size()) >= mJournalSize) {
+        if (FILE *f = fopen(tmp.constData(), "w")) {
+            ok = fwrite(contents.constData() + size, mJournalSize - size, 1, f) == 1;
+            ok = !fclose(f) && ok;
+        }
+    }
+    if (!ok || rename(tmp.constData(), p.constData())) {
+        error() << "Failed to trim" << p;
+        Path::rm(tmp);
+        return;
+    }
+    mJournalSize -= size;
+}
+
+template <typename Visitor>
+static inline uint64_t visitJournal(const String &contents, Visitor visitor)
+{
+    const char *data = contents.constData();
+    uint64_t pos = 0;
+    const uint64_t size = contents.size();
+    uint64_t sizes[2];
+    while (size - pos >= sizeof(sizes)) {
+        memcpy(sizes, data + pos, sizeof(sizes));
+        if (sizes[0] > size - pos - sizeof(sizes) || sizes[1] > size - pos - sizeof(sizes) - sizes[0])
+            break; // torn write
+        pos += sizeof(sizes);
+        visitor(data + pos, sizes[0], data + pos + sizes[0], sizes[1]);
+        pos += sizes[0] + sizes[1];
+    }
+    return pos;
+}
+
+void Project::restoreJournal() // lock always held
+{
+    const Path p = journalFile(mPath);
+    const String contents = p.readAll();
+    if (contents.isEmpty())
+        return;
+
+    int records = 0;
+    const uint64_t valid = visitJournal(contents, [this, &records](const char *eager, uint64_t eagerSize,
+                                                                  const char *, uint64_t) {
+            Set<uint32_t> dirty, removedSources, visited;
+            SourceInformationMap sources;
+            DependencyMap dependencies;
+            Map<uint32_t, String> systemFiles;
+            Deserializer in(eager, static_cast<int>(eagerSize));
+            in >> dirty >> removedSources >> sources >> visited >> dependencies >> systemFiles;
+            mVisitedFiles -= dirty;
+            mVisitedFiles += visited;
+            for (Set<uint32_t>::const_iterator it = dirty.begin(); it != dirty.end(); ++it)
+                mSystemFileKeys.remove(*it);
+            for (Map<uint32_t, String>::const_iterator it = systemFiles.begin(); it != systemFiles.end(); ++it)
+                mSystemFileKeys[it->first] = it->second;
+            for (Set<uint32_t>::const_iterator it = removedSources.begin(); it != removedSources.end(); ++it)
+                mSources.remove(*it);
+            for (SourceInformationMap::const_iterator it = sources.begin(); it != sources.end(); ++it)
+                mSources[it->first] = it->second;
+            Set<uint32_t> newFiles;
+            addDependencies(dependencies, newFiles);
+            ++records;
+        });
+    if (valid != static_cast<uint64_t>(contents.size())) {
+        error() << "Discarding" << (contents.size() - valid) << "bytes of incomplete journal for" << mPath;
+        if (truncate(p.constData(), valid))
+            error() << "Failed to truncate" << p;
+    }
+    mJournalSize = valid;
+    if (records)
+        warning() << "Restored" << records << "journal records for" << mPath;
+}
+
+void Project::replayJournal()
+{
+    const String contents = journalFile(mPath).readAll();
+    visitJournal(contents, [this](const char *, uint64_t, const char *lazy, uint64_t lazySize) {
+            Set<uint32_t> dirty;
+            int count;
+            Deserializer in(lazy, static_cast<int>(lazySize));
+            in >> dirty >> count;
+            if (!dirty.isEmpty())
+                this->dirty(dirty);
+            for (int i=0; i<count; ++i) {
+                IndexData data;
+                in >> data.symbols >> data.symbolNames >> data.usrMap >> data.references;
+                PostingsMap *postings = mPostingsValid ? &mPostings : 0;
+                writeSymbols(data.symbols, mSymbols, mDirtyShards, postings);
+                writeUsr(data.usrMap, mUsr, mSymbols, mDirtyShards, postings);
+                writeReferences(data.references, mSymbols, mDirtyShards, postings);
+                writeSymbolNames(data.symbolNames, mSymbolNames, mDirtyShards, postings, mSymbolNameIndex.get());
+            }
+        });
+}
+
+// An exported index is a DataFile with the project's maps as they are in
+// memory plus a table of the paths its fileIds refer to. Paths inside the
+// project root are stored relative to it so the index can be imported into
+// a checkout somewhere else.
+enum ExportSection {
+    Export_Root = 1,
+    Export_Paths,
+    Export_Hashes,
+    Export_Symbols,
+    Export_SymbolNames,
+    Export_Usr,
+    Export_Dependencies,
+    Export_Sources,
+    Export_VisitedFiles,
+    Export_SystemFiles
+};
+
+// fnv-1a of the contents, mtimes don't survive a checkout
+static inline uint64_t contentHash(const Path &path)
+{
+    const String contents = path.readAll();
+    uint64_t hash = 14695981039346656037ULL;
+    const char *data = contents.constData();
+    for (int i=0; i<contents.size(); ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static inline Set<Location> relocate(const Set<Location> &locations, const Hash<uint32_t, uint32_t> &ids)
+{
+    Set<Location> ret;
+    for (Set<Location>::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        if (const uint32_t fileId = ids.value(it->fileId()))
+            ret.insert(Location(fileId, it->offset()));
+    }
+    return ret;
+}
+
+static inline LocationSet relocate(const LocationSet &locations, const Hash<uint32_t, uint32_t> &ids)
+{
+    LocationSet ret;
+    for (LocationSet::const_iterator it = locations.begin(); it != locations.end(); ++it) {
+        if (const uint32_t fileId = ids.value(it->fileId()))
+            ret.insert(Location(fileId, it->offset()));
+    }
+    return ret;
+}
+
+template <typename T>
+static inline void relocateLocations(const T &map, const Hash<uint32_t, uint32_t> &ids, T &out)
+{
+    for (typename T::const_iterator it = map.begin(); it != map.end(); ++it) {
+        const Set<Location> locations = relocate(it->second, ids);
+        if (!locations.isEmpty())
+            out[it->first].unite(locations);
+    }
+}
+
+static inline Set<uint32_t> relocate(const Set<uint32_t> &fileIds, const Hash<uint32_t, uint32_t> &ids)
+{
+    Set<uint32_t> ret;
+    for (Set<uint32_t>::const_iterator it = fileIds.begin(); it != fileIds.end(); ++it) {
+        if (const uint32_t fileId = ids.value(*it))
+            ret.insert(fileId);
+    }
+    return ret;
+}
+
+// Hashing every file and writing the index takes a while so it's done on a
+// thread of its own, the maps are serialized on the main thread since
+// that's the only one that may read them while they change.
+class ExportThread : public Thread
+{
+public:
+    ExportThread(const Path &file, const std::function<void(const String &)> &done)
+        : file(file), done(done)
+    {
+        setAutoDelete(true);
+    }
+
+    virtual void run()
+    {
+        // two exports to the same file would share its tmp file
+        static std::mutex sMutex;
+        StopWatch timer;
+        Hash<uint32_t, uint64_t> hashes;
+        for (Hash<uint32_t, Path>::const_iterator it = absolutePaths.begin(); it != absolutePaths.end(); ++it) {
+            if (it->second.isFile())
+                hashes[it->first] = contentHash(it->second);
+        }
+        String message;
+        {
+            std::lock_guard<std::mutex> lock(sMutex);
+            DataFileWriter out(file);
+            if (!out.open(Server::DatabaseVersion)) {
+                message = String::format<128>("Can't open %s for writing", file.constData());
+            } else {
+                out.write(Export_Root, root);
+                out.write(Export_Paths, paths);
+                out.write(Export_Hashes, hashes);
+                out.writeRaw(Export_Symbols, symbols.constData(), symbols.size());
+                out.writeRaw(Export_SymbolNames, symbolNames.constData(), symbolNames.size());
+                out.writeRaw(Export_Usr, usr.constData(), usr.size());
+                out.write(Export_Dependencies, dependencies);
+                out.write(Export_Sources, sources);
+                out.write(Export_VisitedFiles, visitedFiles);
+                out.write(Export_SystemFiles, systemFiles);
+                if (!out.commit())
+                    message = String::format<128>("Failed to write %s", file.constData());
+            }
+        }
+        if (message.isEmpty()) {
+            message = String::format<256>("Exported %d files from %s to %s in %dms",
+                                          static_cast<int>(paths.size()), root.constData(), file.constData(),
+                                          serializeTime + timer.elapsed());
+        }
+        EventLoop::mainEventLoop()->callLater(std::bind(done, message));
+    }
+
+    const Path file;
+    const std::function<void(const String &)> done;
+    Path root;
+    Hash<uint32_t, Path> paths, absolutePaths;
+    String symbols, symbolNames, usr;
+    DependencyMap dependencies;
+    SourceInformationMap sources;
+    Set<uint32_t> visitedFiles;
+    Map<uint32_t, String> systemFiles;
+    int serializeTime;
+};
+
+void Project::exportIndex(const Path &file, const std::function<void(const String &)> &done) const
+{
+    StopWatch timer;
+    loadSections(AllSections);
+    ExportThread *thread = new ExportThread(file, done);
+    thread->root = mPath;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        thread->dependencies = mDependencies;
+        thread->sources = mSources;
+        thread->visitedFiles = mVisitedFiles;
+        thread->systemFiles = mSystemFileKeys;
+    }
+
+    Set<uint32_t> fileIds = thread->visitedFiles;
+    for (DependencyMap::const_iterator it = thread->dependencies.begin(); it != thread->dependencies.end(); ++it) {
+        fileIds.insert(it->first);
+        fileIds += it->second;
+    }
+    for (SourceInformationMap::const_iterator it = thread->sources.begin(); it != thread->sources.end(); ++it)
+        fileIds.insert(it->first);
+
+    for (Set<uint32_t>::const_iterator it = fileIds.begin(); it != fileIds.end(); ++it) {
+        const Path path = Location::path(*it);
+        if (path.isEmpty())
+            continue;
+        thread->paths[*it] = path.startsWith(mPath) ? Path(path.mid(mPath.size())) : path;
+        thread->absolutePaths[*it] = path;
+    }
+
+    {
+        Serializer serializer(thread->symbols);
+        serializer << mSymbols;
+    }
+    {
+        Serializer serializer(thread->symbolNames);
+        serializer << mSymbolNames;
+    }
+    {
+        Serializer serializer(thread->usr);
+        serializer << mUsr;
+    }
+    thread->serializeTime = timer.elapsed();
+    thread->start();
+}
+
+// What ImportThread reads from an exported index, already relocated to our
+// fileIds. Applied on the main thread if the project is still waiting for
+// it.
+struct ImportedIndex
+{
+    Path root;
+    int fileCount;
+    Set<uint32_t> changed, missing;
+    SymbolMap symbols;
+    SymbolNameMap symbolNames;
+    UsrMap usrs;
+    DependencyMap dependencies;
+    SourceInformationMap sources;
+    Set<uint32_t> visitedFiles;
+    Map<uint32_t, String> systemFileKeys;
+    Hash<uint32_t, std::shared_ptr<const SystemShard> > systemFiles;
+    String error;
+    int readTime;
+};
+
+class ImportThread : public Thread
+{
+public:
+    ImportThread(const std::shared_ptr<Project> &project, const Path &file,
+                 const std::shared_ptr<ImportedIndex> &index)
+        : mProject(project), mPath(project->path()), mFile(file), mIndex(index)
+    {
+        setAutoDelete(true);
+    }
+
+    virtual void run()
+    {
+        StopWatch timer;
+        read(*mIndex);
+        mIndex->readTime = timer.elapsed();
+        if (std::shared_ptr<Project> project = mProject.lock())
+            EventLoop::mainEventLoop()->callLater(std::bind(&Project::onImportFinished, project, mIndex));
+    }
+private:
+    void read(ImportedIndex &index)
+    {
+        DataFile in(mFile);
+        if (!in.open(Server::DatabaseVersion)) {
+            index.error = in.errorString();
+            return;
+        }
+        Hash<uint32_t, Path> paths;
+        Hash<uint32_t, uint64_t> hashes;
+        SymbolMap symbols;
+        SymbolNameMap symbolNames;
+        UsrMap usrs;
+        DependencyMap dependencies;
+        SourceInformationMap sources;
+        Set<uint32_t> visitedFiles;
+        Map<uint32_t, String> systemFiles;
+        if (!in.read(Export_Root, index.root) || !in.read(Export_Paths, paths) || !in.read(Export_Hashes, hashes)
+            || !in.read(Export_Symbols, symbols) || !in.read(Export_SymbolNames, symbolNames)
+            || !in.read(Export_Usr, usrs) || !in.read(Export_Dependencies, dependencies)
+            || !in.read(Export_Sources, sources) || !in.read(Export_VisitedFiles, visitedFiles)
+            || !in.read(Export_SystemFiles, systemFiles)) {
+            index.error = String::format<128>("%s seems to be corrupted", mFile.constData());
+            return;
+        }
+
+        // map the exported fileIds into ours and find the files that don't
+        // match what was indexed
+        Hash<uint32_t, uint32_t> ids;
+        for (Hash<uint32_t, Path>::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+            const Path path = it->second.isAbsolute() ? it->second : Path(mPath + it->second);
+            const uint32_t fileId = Location::insertFile(path);
+            ids[it->first] = fileId;
+            const Hash<uint32_t, uint64_t>::const_iterator hash = hashes.find(it->first);
+            if (!path.isFile()) {
+                index.missing.insert(fileId);
+                index.changed.insert(fileId);
+            } else if (hash == hashes.end() || contentHash(path) != hash->second) {
+                index.changed.insert(fileId);
+            }
+        }
+        index.fileCount = ids.size();
+
+        for (SymbolMap::const_iterator it = symbols.begin(); it != symbols.end(); ++it) {
+            if (const uint32_t fileId = ids.value(it->first.fileId())) {
+                CursorInfo &info = index.symbols[Location(fileId, it->first.offset())];
+                info = it->second;
+                info.targets = relocate(it->second.targets, ids);
+                info.references = relocate(it->second.references, ids);
+            }
+        }
+        relocateLocations(symbolNames, ids, index.symbolNames);
+        relocateLocations(usrs, ids, index.usrs);
+        for (DependencyMap::const_iterator it = dependencies.begin(); it != dependencies.end(); ++it) {
+            if (const uint32_t fileId = ids.value(it->first))
+                index.dependencies[fileId] = relocate(it->second, ids);
+        }
+        // the arguments usually point into the tree as well
+        const time_t now = time(0);
+        for (SourceInformationMap::const_iterator it = sources.begin(); it != sources.end(); ++it) {
+            const uint32_t fileId = ids.value(it->first);
+            if (!fileId || index.missing.contains(fileId))
+                continue;
+            SourceInformation &source = index.sources[fileId];
+            source = it->second;
+            source.fileId = fileId;
+            source.parsed = now;
+            if (source.compiler.startsWith(index.root))
+                source.compiler = mPath + source.compiler.mid(index.root.size());
+            for (int i=0; i<source.args.size(); ++i)
+                source.args[i].replace(index.root, mPath);
+        }
+        index.visitedFiles = relocate(visitedFiles, ids);
+
+        // The system headers aren't in the maps, they're served by a system
+        // index. If ours has them as well they're served from there,
+        // otherwise they're indexed again along with the files that
+        // include them.
+        for (Map<uint32_t, String>::const_iterator it = systemFiles.begin(); it != systemFiles.end(); ++it) {
+            const uint32_t fileId = ids.value(it->first);
+            if (!fileId)
+                continue;
+            const std::shared_ptr<SystemIndex> systemIndex = Server::instance()->systemIndex(it->second);
+            std::shared_ptr<const SystemShard> shard;
+            if (systemIndex && !index.changed.contains(fileId))
+                shard = systemIndex->shard(fileId);
+            if (shard) {
+                index.systemFiles[fileId] = shard;
+                index.systemFileKeys[fileId] = it->second;
+            } else {
+                index.visitedFiles.remove(fileId);
+                index.changed.insert(fileId);
+            }
+        }
+    }
+
+    std::weak_ptr<Project> mProject;
+    const Path mPath, mFile;
+    const std::shared_ptr<ImportedIndex> mIndex;
+};
+
+void Project::importIndex(const Path &file, const std::function<void(bool, const String &)> &done)
+{
+    std::shared_ptr<ImportedIndex> index(new ImportedIndex);
+    bool loaded = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mState != Unloaded && mState != Inited) {
+            loaded = true;
+        } else {
+            // keeps load() from restoring the old database meanwhile
+            mState = Loading;
+            mPendingImport = index;
+            mImportFinished = done;
+        }
+    }
+    if (loaded) {
+        done(false, String::format<128>("%s is loaded, unload it first", mPath.constData()));
+        return;
+    }
+    ImportThread *thread = new ImportThread(shared_from_this(), file, index);
+    thread->start();
+}
+
+void Project::onImportFinished(const std::shared_ptr<ImportedIndex> &index)
+{
+    StopWatch timer;
+    std::function<void(bool, const String &)> done;
+    // compiles that came in while we were Loading
+    Hash<Path, std::pair<Path, List<String> > > pendingCompiles;
+    bool reload = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mPendingImport != index)
+            return; // unloaded in the meantime
+        mPendingImport.reset();
+        std::swap(done, mImportFinished);
+        if (!index->error.isEmpty()) {
+            // the compiles are run once the database we had is restored
+            mState = Unloaded;
+            reload = !mPendingCompiles.isEmpty();
+        } else {
+            pendingCompiles = std::move(mPendingCompiles);
+            if (!fileManager) {
+                fileManager.reset(new FileManager);
+                fileManager->init(shared_from_this(), FileManager::Asynchronous);
+            }
+            clearSymbolViews();
+            mPostingsValid = false;
+            mSymbols = std::move(index->symbols);
+            mSymbolNames = std::move(index->symbolNames);
+            mUsr = std::move(index->usrs);
+            mDependencies = std::move(index->dependencies);
+            mSources = std::move(index->sources);
+            mVisitedFiles = std::move(index->visitedFiles);
+            mSystemFileKeys = std::move(index->systemFileKeys);
+            mSystemFiles = std::move(index->systemFiles);
+            mState = Loaded;
+        }
+    }
+    if (!index->error.isEmpty()) {
+        if (reload)
+            load();
+        done(false, index->error);
+        return;
+    }
+    Path::rm(journalFile(mPath));
+    for (DependencyMap::const_iterator it = mDependencies.begin(); it != mDependencies.end(); ++it) {
+        if (!index->missing.contains(it->first))
+            watch(Location::path(it->first));
+    }
+    save();
+    // dirtying them takes care of the symbols of the missing ones
+    if (!index->changed.isEmpty())
+        startDirtyJobs(index->changed);
+    for (Hash<Path, std::pair<Path, List<String> > >::const_iterator it = pendingCompiles.begin(); it != pendingCompiles.end(); ++it)
+        this->index(it->first, it->second.first, it->second.second);
+    done(true, String::format<256>("Imported %d files from %s into %s in %dms, %d changed",
+                                   index->fileCount, index->root.constData(), mPath.constData(),
+                                   index->readTime + timer.elapsed(), static_cast<int>(index->changed.size())));
+}
+
 bool Project::isIndexed(uint32_t fileId) const
 {
+    std::lock_guard<std::mutex> lock(mMutex);
     return mVisitedFiles.contains(fileId) || mSources.contains(fileId);
 }
 
@@ -970,9 +2435,16 @@ void Project::sync()
     mSyncTimer.stop();
     int dirtyTime, syncTime;
     mJobCounter -= mPendingData.size();
-    syncDB(&dirtyTime, &syncTime);
+    String journal;
+    syncDB(&dirtyTime, &syncTime, &journal);
     StopWatch sw;
-    save();
+    if (!journal.isEmpty()) {
+        const Path base = projectFile(mPath);
+        if (!base.isFile() || !appendJournal(journal)
+            || (mJournalSize * JournalCompactionRatio > static_cast<uint64_t>(base.fileSize()) && !isIndexing())) {
+            save();
+        }
+    }
     const int saveTime = sw.elapsed();
     error() << "Jobs took" << (static_cast<double>(mTimer.elapsed()) / 1000.0)
             << "secs, dirtying took"
@@ -995,6 +2467,130 @@ void Project::reloadFileManager()
     fileManager->reload(FileManager::Asynchronous);
 }
 
+// Rough per entry overhead of the containers, a tree node has three
+// pointers and a color, a hash node a next pointer, its cached hash and a
+// bucket. The strings are counted by length.
+enum {
+    MapNodeOverhead = 32,
+    HashNodeOverhead = 24
+};
+
+template <typename T>
+static inline uint64_t setMemory(const Set<T> &set)
+{
+    return set.size() * (MapNodeOverhead + sizeof(T));
+}
+
+static inline uint64_t symbolsMemory(const SymbolMap &symbols)
+{
+    uint64_t ret = 0;
+    for (SymbolMap::const_iterator it = symbols.begin(); it != symbols.end(); ++it) {
+        ret += MapNodeOverhead + sizeof(SymbolMap::value_type)
+               + it->second.targets.memoryUsage() + it->second.references.memoryUsage();
+    }
+    return ret;
+}
+
+List<Project::MemoryUsage> Project::memoryUsage() const
+{
+    List<MemoryUsage> ret;
+    MemoryUsage usage = { "symbols", mSymbols.size(), symbolsMemory(mSymbols) };
+    ret.append(usage);
+
+    usage.name = "symbolnames";
+    usage.count = mSymbolNames.size();
+    usage.bytes = 0;
+    for (SymbolNameMap::const_iterator it = mSymbolNames.begin(); it != mSymbolNames.end(); ++it)
+        usage.bytes += MapNodeOverhead + sizeof(SymbolNameMap::value_type) + it->first.size() + setMemory(it->second);
+    ret.append(usage);
+
+    usage.name = "usrs";
+    usage.count = mUsr.size();
+    usage.bytes = 0;
+    for (UsrMap::const_iterator it = mUsr.begin(); it != mUsr.end(); ++it)
+        usage.bytes += HashNodeOverhead + sizeof(UsrMap::value_type) + setMemory(it->second);
+    ret.append(usage);
+
+    usage.name = "errorsymbols";
+    usage.count = 0;
+    usage.bytes = 0;
+    for (ErrorSymbolMap::const_iterator it = mErrorSymbols.begin(); it != mErrorSymbols.end(); ++it) {
+        usage.count += it->second.size();
+        usage.bytes += HashNodeOverhead + sizeof(ErrorSymbolMap::value_type) + symbolsMemory(it->second);
+    }
+    ret.append(usage);
+
+    usage.name = "postings";
+    usage.count = mPostings.size();
+    usage.bytes = 0;
+    for (PostingsMap::const_iterator it = mPostings.begin(); it != mPostings.end(); ++it) {
+        const FilePostings &p = it->second;
+        usage.bytes += HashNodeOverhead + sizeof(PostingsMap::value_type)
+                       + p.symbolNames.capacity() * sizeof(SymbolNameMap::iterator)
+                       + p.usrs.capacity() * sizeof(uint64_t) + setMemory(p.referrers) + setMemory(p.referred);
+    }
+    ret.append(usage);
+
+    {
+        // only counted if they're built, asking for them would build them
+        std::lock_guard<std::mutex> lock(mSymbolViewsMutex);
+        usage.name = "symbolnameindex";
+        usage.count = mSymbolNameIndex ? mSymbolNameIndex->count() : 0;
+        usage.bytes = mSymbolNameIndex ? mSymbolNameIndex->memoryUsage() : 0;
+        ret.append(usage);
+
+        usage.name = "referencegraph";
+        usage.count = mReferenceGraph ? mReferenceGraph->count() : 0;
+        usage.bytes = mReferenceGraph ? mReferenceGraph->memoryUsage() : 0;
+        ret.append(usage);
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    usage.name = "dependencies";
+    usage.count = mDependencies.size();
+    usage.bytes = 0;
+    for (DependencyMap::const_iterator it = mDependencies.begin(); it != mDependencies.end(); ++it)
+        usage.bytes += HashNodeOverhead + sizeof(DependencyMap::value_type) + setMemory(it->second);
+    ret.append(usage);
+
+    usage.name = "sources";
+    usage.count = mSources.size();
+    usage.bytes = 0;
+    for (SourceInformationMap::const_iterator it = mSources.begin(); it != mSources.end(); ++it) {
+        usage.bytes += MapNodeOverhead + sizeof(SourceInformationMap::value_type) + it->second.compiler.size();
+        for (List<String>::const_iterator arg = it->second.args.begin(); arg != it->second.args.end(); ++arg)
+            usage.bytes += sizeof(String) + arg->size();
+    }
+    ret.append(usage);
+
+    usage.name = "fixits";
+    usage.count = 0;
+    usage.bytes = 0;
+    for (FixItMap::const_iterator it = mFixIts.begin(); it != mFixIts.end(); ++it) {
+        usage.count += it->second.size();
+        usage.bytes += HashNodeOverhead + sizeof(FixItMap::value_type) + setMemory(it->second);
+        for (Set<FixIt>::const_iterator f = it->second.begin(); f != it->second.end(); ++f)
+            usage.bytes += f->text.size();
+    }
+    ret.append(usage);
+
+    // clang knows what its translation units use
+    usage.name = "cachedunits";
+    usage.count = 0;
+    usage.bytes = 0;
+    for (LinkedList<CachedUnit*>::const_iterator it = mCachedUnits.begin(); it != mCachedUnits.end(); ++it) {
+        if (!(*it)->unit)
+            continue;
+        ++usage.count;
+        CXTUResourceUsage resources = clang_getCXTUResourceUsage((*it)->unit);
+        for (unsigned i=0; i<resources.numEntries; ++i)
+            usage.bytes += resources.entries[i].amount;
+        clang_disposeCXTUResourceUsage(resources);
+    }
+    ret.append(usage);
+    return ret;
+}
+
 List<std::pair<Path, List<String> > > Project::cachedUnits() const
 {
     std::lock_guard<std::mutex> lock(mMutex);
@@ -1020,6 +2616,7 @@ static inline bool matchSymbolName(const String &needle, const String &haystack)
 
 Set<Location> Project::locations(const String &symbolName, uint32_t fileId) const
 {
+    loadSections(SymbolsSection|SymbolNamesSection);
     Set<Location> ret;
     if (fileId) {
         const SymbolMap s = symbols(fileId);
@@ -1033,11 +2630,19 @@ Set<Location> Project::locations(const String &symbolName, uint32_t fileId) cons
                 ret.insert(it->first);
         }
     } else {
-        SymbolNameMap::const_iterator it = mSymbolNames.lower_bound(symbolName);
-        while (it != mSymbolNames.end() && it->first.startsWith(symbolName)) {
-            if (matchSymbolName(symbolName, it->first))
-                ret.unite(it->second);
-            ++it;
+        List<const SymbolNameIndex*> indexes;
+        const std::shared_ptr<SymbolNameIndex> index = symbolNameIndex();
+        indexes.append(index.get());
+        const List<std::shared_ptr<const SystemShard> > shards = systemShards();
+        for (int i=0; i<shards.size(); ++i)
+            indexes.append(shards.at(i)->names.get());
+        for (int i=0; i<indexes.size(); ++i) {
+            const SymbolNameIndex *idx = indexes.at(i);
+            for (SymbolNameIndex::const_iterator it = idx->lowerBound(symbolName);
+                 it != idx->end() && SymbolNameIndex::startsWith(it, symbolName); ++it) {
+                if (matchSymbolName(symbolName, SymbolNameIndex::name(it)))
+                    ret.unite(SymbolNameIndex::locations(it));
+            }
         }
     }
     return ret;
@@ -1045,6 +2650,7 @@ Set<Location> Project::locations(const String &symbolName, uint32_t fileId) cons
 
 List<RTags::SortedCursor> Project::sort(const Set<Location> &locations, unsigned int flags) const
 {
+    loadSections(SymbolsSection);
     List<RTags::SortedCursor> sorted;
     sorted.reserve(locations.size());
     for (Set<Location>::const_iterator it = locations.begin(); it != locations.end(); ++it) {
@@ -1070,10 +2676,90 @@ List<RTags::SortedCursor> Project::sort(const Set<Location> &locations, unsigned
     return sorted;
 }
 
+std::shared_ptr<FileSymbols> Project::fileSymbols(uint32_t fileId) const
+{
+    const SymbolMap &map = symbols();
+    std::lock_guard<std::mutex> lock(mSymbolViewsMutex);
+    std::shared_ptr<FileSymbols> &file = mFileSymbols[fileId];
+    if (!file)
+        file.reset(new FileSymbols(map, fileId));
+    return file;
+}
+
+std::shared_ptr<ReferenceGraph> Project::referenceGraph() const
+{
+    const SymbolMap &map = symbols();
+    const bool idle = !isIndexing() && mPendingData.isEmpty() && mPendingDirtyFiles.isEmpty();
+    std::lock_guard<std::mutex> lock(mSymbolViewsMutex);
+    if (!mReferenceGraph && idle) {
+        StopWatch timer;
+        mReferenceGraph.reset(new ReferenceGraph(map));
+        warning() << "Built reference graph for" << mPath << "with" << mReferenceGraph->count()
+                  << "cursors and" << mReferenceGraph->edgeCount() << "edges in" << timer.elapsed() << "ms"
+                  << "using" << mReferenceGraph->memoryUsage() << "bytes";
+    }
+    return mReferenceGraph;
+}
+
+std::shared_ptr<SymbolNameIndex> Project::symbolNameIndex() const
+{
+    const SymbolNameMap &map = symbolNames();
+    std::lock_guard<std::mutex> lock(mSymbolViewsMutex);
+    if (!mSymbolNameIndex) {
+        StopWatch timer;
+        mSymbolNameIndex.reset(new SymbolNameIndex(map));
+        warning() << "Built symbol name index for" << mPath << "with" << mSymbolNameIndex->count()
+                  << "names in" << timer.elapsed() << "ms";
+    }
+    return mSymbolNameIndex;
+}
+
+void Project::clearSymbolViews(unsigned sections) const
+{
+    std::lock_guard<std::mutex> lock(mSymbolViewsMutex);
+    if (sections & SymbolsSection) {
+        mFileSymbols.clear();
+        mReferenceGraph.reset();
+    }
+    if (sections & SymbolNamesSection)
+        mSymbolNameIndex.reset();
+}
+
+SymbolMap::const_iterator Project::findCursorInfo(const Location &location, const String &context,
+                                                  const SymbolMap *errors, bool *foundInErrors) const
+{
+    if (foundInErrors)
+        *foundInErrors = false;
+    const SymbolMap &map = symbols();
+    if (const std::shared_ptr<const SystemShard> shard = systemShard(location.fileId())) {
+        // the cursors of the header are in the index, ours only add the
+        // references from the project
+        const SymbolMap::const_iterator found = FileSymbols(shard->symbols, location.fileId()).find(location, context, true, shard->symbols.end());
+        if (found != shard->symbols.end()) {
+            const SymbolMap::const_iterator own = map.find(found->first);
+            return own != map.end() ? own : found;
+        }
+    }
+    // errors are only consulted for exact matches, just like RTags::findCursorInfo()
+    const SymbolMap::const_iterator ret = fileSymbols(location.fileId())->find(location, context, !errors, map.end());
+    if (ret != map.end() || !errors)
+        return ret;
+    const SymbolMap::const_iterator error = FileSymbols(*errors, location.fileId()).find(location, context, false, errors->end());
+    if (error != errors->end()) {
+        if (foundInErrors)
+            *foundInErrors = true;
+        return error;
+    }
+    return map.end();
+}
+
 SymbolMap Project::symbols(uint32_t fileId) const
 {
+    loadSections(SymbolsSection);
     SymbolMap ret;
     if (fileId) {
+        if (const std::shared_ptr<const SystemShard> shard = systemShard(fileId))
+            ret = shard->symbols;
         for (SymbolMap::const_iterator it = mSymbols.lower_bound(Location(fileId, 0));
              it != mSymbols.end() && it->first.fileId() == fileId; ++it) {
             ret[it->first] = it->second;
@@ -1082,6 +2768,17 @@ SymbolMap Project::symbols(uint32_t fileId) const
     return ret;
 }
 
+List<std::shared_ptr<const SystemShard> > Project::systemShards() const
+{
+    Set<const SystemShard*> seen;
+    List<std::shared_ptr<const SystemShard> > ret;
+    for (Hash<uint32_t, std::shared_ptr<const SystemShard> >::const_iterator it = mSystemFiles.begin(); it != mSystemFiles.end(); ++it) {
+        if (seen.insert(it->second.get()))
+            ret.append(it->second);
+    }
+    return ret;
+}
+
 void Project::watch(const Path &file)
 {
     const Path dir = file.parentDir();
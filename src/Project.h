@@ -25,6 +25,8 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include <rct/RegExp.h>
 #include <rct/FileSystemWatcher.h>
 #include "IndexerJob.h"
+#include <atomic>
+#include <functional>
 #include <mutex>
 #include <memory>
 
@@ -51,7 +53,31 @@ struct CachedUnit
     int parseCount;
 };
 
+// What a file contributed to the project maps that aren't keyed by its
+// location, so dirtying it doesn't have to scan them. Symbol names and usrs
+// can repeat, they're dropped when the file is dirtied.
+struct FilePostings
+{
+    // symbol names and usrs with locations in the file
+    List<SymbolNameMap::iterator> symbolNames;
+    List<uint64_t> usrs;
+    // cursors in other files with targets or references in the file
+    Set<Location> referrers;
+    // files whose referrers have cursors in this file, they're removed from
+    // there when this file is dirtied
+    Set<uint32_t> referred;
+};
+typedef Hash<uint32_t, FilePostings> PostingsMap;
+
+class DataFile;
+class FileSymbols;
+class ReferenceGraph;
+class SymbolNameIndex;
+struct SaveSnapshot;
+struct ImportedIndex;
 class FileManager;
+class IndexSession;
+struct SystemShard;
 class IndexerJob;
 class IndexData;
 class Project : public std::enable_shared_from_this<Project>
@@ -67,8 +93,10 @@ public:
     };
     State state() const;
     void init();
-    bool restore();
-    void startPendingJobs();
+    // runs on the RestoreThread, files to reindex and whether to save are
+    // passed on to startPendingJobs() on the main thread
+    bool restore(Set<uint32_t> &dirty, bool &needsSave);
+    void startPendingJobs(const Set<uint32_t> &dirty, bool needsSave);
 
     enum FileManagerMode {
         FileManager_Asynchronous,
@@ -83,17 +111,32 @@ public:
 
     bool match(const Match &match, bool *indexed = 0) const;
 
-    const SymbolMap &symbols() const { return mSymbols; }
-    SymbolMap &symbols() { return mSymbols; }
+    const SymbolMap &symbols() const { loadSections(SymbolsSection); return mSymbols; }
+    SymbolMap &symbols() { loadSections(SymbolsSection); return mSymbols; }
 
     const ErrorSymbolMap &errorSymbols() const { return mErrorSymbols; }
     ErrorSymbolMap &errorSymbols() { return mErrorSymbols; }
 
-    const SymbolNameMap &symbolNames() const { return mSymbolNames; }
-    SymbolNameMap &symbolNames() { return mSymbolNames; }
+    const SymbolNameMap &symbolNames() const { loadSections(SymbolNamesSection); return mSymbolNames; }
+    SymbolNameMap &symbolNames() { loadSections(SymbolNamesSection); return mSymbolNames; }
 
     Set<Location> locations(const String &symbolName, uint32_t fileId = 0) const;
     SymbolMap symbols(uint32_t fileId) const;
+    // flat view of the symbols in fileId, rebuilt lazily when they change
+    std::shared_ptr<FileSymbols> fileSymbols(uint32_t fileId) const;
+    // like RTags::findCursorInfo() but uses fileSymbols() for the lookup
+    SymbolMap::const_iterator findCursorInfo(const Location &location, const String &context = String(),
+                                             const SymbolMap *errors = 0, bool *foundInErrors = 0) const;
+    // targets and references of all symbols. Every sync drops it so it's only
+    // built while the project isn't indexing, null otherwise
+    std::shared_ptr<ReferenceGraph> referenceGraph() const;
+    // every name the symbol names can be looked up by, built lazily and
+    // updated as they change
+    std::shared_ptr<SymbolNameIndex> symbolNameIndex() const;
+    // the system headers that are served by a SystemIndex rather than stored
+    // here, see syncDB()
+    std::shared_ptr<const SystemShard> systemShard(uint32_t fileId) const { return mSystemFiles.value(fileId); }
+    List<std::shared_ptr<const SystemShard> > systemShards() const;
     enum SortFlag {
         Sort_None = 0x0,
         Sort_DeclarationOnly = 0x1,
@@ -104,8 +147,8 @@ public:
     const FilesMap &files() const { return mFiles; }
     FilesMap &files() { return mFiles; }
 
-    const UsrMap &usrs() const { return mUsr; }
-    UsrMap &usrs() { return mUsr; }
+    const UsrMap &usrs() const { loadSections(UsrSection); return mUsr; }
+    UsrMap &usrs() { loadSections(UsrSection); return mUsr; }
 
     const Set<uint32_t> &suspendedFiles() const;
     bool toggleSuspendFile(uint32_t file);
@@ -123,6 +166,10 @@ public:
     };
     Set<uint32_t> dependencies(uint32_t fileId, DependencyMode mode) const;
     bool visitFile(uint32_t fileId);
+    // The Makefile jobs of a project parse through one session with
+    // --skip-parsed-bodies. A new one is started whenever visited files are
+    // released, see IndexerJobClang::parse().
+    std::shared_ptr<IndexSession> indexSession() const;
     String fixIts(uint32_t fileId) const;
     int reindex(const Match &match);
     int remove(const Match &match);
@@ -135,8 +182,57 @@ public:
     void onTimerFired(Timer* event);
     bool isIndexing() const { std::lock_guard<std::mutex> lock(mMutex); return !mJobs.isEmpty(); }
     void onJSFilesAdded();
+    void onSaveFinished(const std::shared_ptr<SaveSnapshot> &snapshot, bool ok);
     List<std::pair<Path, List<String> > > cachedUnits() const;
+
+    // entry count and estimated size of one of the in-memory structures
+    struct MemoryUsage
+    {
+        const char *name;
+        int count;
+        uint64_t bytes;
+    };
+    // only counts what is loaded, sections still in the database are left out
+    List<MemoryUsage> memoryUsage() const;
+
+    // writes a relocatable copy of the index, paths inside the project are
+    // stored relative to its root. Both do the file work on a thread and
+    // call done on the main thread
+    void exportIndex(const Path &file, const std::function<void(const String &)> &done) const;
+    // replaces the index of an unloaded project with an exported one,
+    // files that differ from what was exported are reindexed
+    void importIndex(const Path &file, const std::function<void(bool, const String &)> &done);
+    void onImportFinished(const std::shared_ptr<ImportedIndex> &index);
+
+    // Read-only queries are answered while restoring, possibly with
+    // incomplete results
+    bool isQueryable() const
+    {
+        const State s = state();
+        return s == Loading || s == Loaded;
+    }
 private:
+    // The big maps are restored lazily from the mmap'ed database the first
+    // time someone asks for them
+    enum LazySection {
+        SymbolsSection = 0x1,
+        SymbolNamesSection = 0x2,
+        UsrSection = 0x4,
+        AllSections = SymbolsSection|SymbolNamesSection|UsrSection
+    };
+    void loadSections(unsigned sections) const;
+    void loadPendingSections(unsigned sections) const;
+    void loadSectionsLocked(unsigned sections) const;
+    // drops the views of the given sections
+    void clearSymbolViews(unsigned sections = AllSections) const;
+
+    void restoreJournal();
+    void replayJournal();
+    void replayPendingJournalLocked();
+    void writeJournalRecord(const Set<uint32_t> &dirty, String &out) const;
+    bool appendJournal(const String &record);
+    void trimJournal(uint64_t size);
+
     void watch(const Path &file);
     void index(const SourceInformation &args, IndexerJob::Type type);
     void reloadFileManager();
@@ -146,8 +242,13 @@ private:
     void onFileModified(const Path &);
     void addDependencies(const DependencyMap &hash, Set<uint32_t> &newFiles);
     void addFixIts(const DependencyMap &dependencies, const FixItMap &fixIts);
-    void syncDB(int *dirtyTime, int *syncTime);
+    void syncDB(int *dirtyTime, int *syncTime, String *journal = 0);
+    void dirty(const Set<uint32_t> &fileIds);
+    void buildPostings();
     void startDirtyJobs(const Set<uint32_t> &files);
+    void addSystemFiles(IndexData &data, Set<uint32_t> &missing);
+    void completeSystemCursors(const IndexReferenceMap &references, PostingsMap *postings);
+    void releaseFiles(const Set<uint32_t> &files);
     void addCachedUnit(const Path &path, const List<String> &args, CXTranslationUnit unit, int parseCount);
     bool save();
     void sync();
@@ -171,6 +272,11 @@ private:
     };
 
     Set<uint32_t> mVisitedFiles;
+    // fileId -> key of the SystemIndex that serves it, the shards are only
+    // touched on the main thread
+    Map<uint32_t, String> mSystemFileKeys;
+    Hash<uint32_t, std::shared_ptr<const SystemShard> > mSystemFiles, mRestoredSystemFiles;
+    mutable std::shared_ptr<IndexSession> mIndexSession;
 
     int mJobCounter;
 
@@ -203,8 +309,41 @@ private:
 
     LinkedList<CachedUnit*> mCachedUnits;
     Set<uint32_t> mSuspendedFiles;
+
+    mutable std::mutex mSectionMutex;
+    mutable std::atomic<unsigned> mPendingSections;
+    mutable std::shared_ptr<DataFile> mDataFile;
+    bool mJournalReplayPending; // replayed on the main thread
+    uint64_t mJournalSize;
+    Set<uint32_t> mDirtyShards;
+
+    // built on the first dirty() after the maps are loaded and kept up to
+    // date by syncDB() from then on
+    PostingsMap mPostings;
+    bool mPostingsValid;
+
+    // views of mSymbols and mSymbolNames, protected by mSymbolViewsMutex. Once
+    // built mSymbolNameIndex is kept up to date by dirty() and syncDB(), on
+    // the main thread like mSymbolNames
+    mutable std::mutex mSymbolViewsMutex;
+    mutable Hash<uint32_t, std::shared_ptr<FileSymbols> > mFileSymbols;
+    mutable std::shared_ptr<ReferenceGraph> mReferenceGraph;
+    mutable std::shared_ptr<SymbolNameIndex> mSymbolNameIndex;
+
+    // save() serializes the dirty shards and writes them on a separate thread
+    std::shared_ptr<SaveSnapshot> mSaveSnapshot;
+    // importIndex() waiting for its thread, dropped by unload()
+    std::shared_ptr<ImportedIndex> mPendingImport;
+    std::function<void(bool, const String &)> mImportFinished;
+    bool mSaveRequested;
 };
 
+inline void Project::loadSections(unsigned sections) const
+{
+    if (mPendingSections & sections)
+        loadPendingSections(sections);
+}
+
 inline bool Project::visitFile(uint32_t fileId)
 {
     std::lock_guard<std::mutex> lock(mMutex);
@@ -35,11 +35,13 @@ public:
         DeleteProject,
         Dependencies,
         DumpFile,
+        ExportIndex,
         FindFile,
         FindSymbols,
         FixIts,
         FollowLocation,
         HasFileManager,
+        ImportIndex,
         Invalid,
         IsIndexed,
         IsIndexing,
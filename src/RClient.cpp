@@ -47,6 +47,7 @@ enum OptionType {
     DisplayName,
     DumpFile,
     ElispList,
+    ExportIndex,
     FilterSystemHeaders,
     FindFile,
     FindFilePreferExact,
@@ -58,6 +59,7 @@ enum OptionType {
     HasFileManager,
     Help,
     IMenu,
+    ImportIndex,
     IsIndexed,
     IsIndexing,
     JSON,
@@ -128,6 +130,8 @@ struct Option opts[] = {
     { UnloadProject, "unload", 'u', required_argument, "Unload project(s) matching argument." },
     { ReloadProjects, "reload-projects", 'z', no_argument, "Reload projects from projects file." },
     { JobCount, "jobcount", 'j', optional_argument, "Set or query current job count." },
+    { ExportIndex, "export-index", 0, required_argument, "Write a relocatable copy of the current project's index to arg." },
+    { ImportIndex, "import-index", 0, required_argument, "Replace the index of the project in the current directory with one written by --export-index." },
 
     { None, 0, 0, 0, "" },
     { None, 0, 0, 0, "Commands:" },
@@ -833,6 +837,21 @@ bool RClient::parse(int argc, char **argv)
         case UnloadProject:
             addQuery(QueryMessage::UnloadProject, optarg);
             break;
+        case ExportIndex:
+            addQuery(QueryMessage::ExportIndex, Path::resolved(optarg, Path::MakeAbsolute));
+            break;
+        case ImportIndex: {
+            const Path file = Path::resolved(optarg, Path::MakeAbsolute);
+            if (!file.isFile()) {
+                fprintf(stderr, "%s is not a file\n", optarg);
+                return false;
+            }
+            Path root = RTags::findProjectRoot(Path::pwd());
+            if (root.isEmpty())
+                root = Path::pwd();
+            // the project the index is imported into is wherever rc was run
+            addQuery(QueryMessage::ImportIndex, file + "\n" + root.ensureTrailingSlash());
+            break; }
         case FindProjectRoot: {
             const Path p = Path::resolved(optarg);
             printf("findProjectRoot [%s] => [%s]\n", p.constData(),
@@ -50,7 +50,8 @@ void initMessages();
 class CursorInfo;
 typedef Map<Location, CursorInfo> SymbolMap;
 typedef Hash<uint32_t, SymbolMap> ErrorSymbolMap;
-typedef Hash<String, Set<Location> > UsrMap;
+// keyed by RTags::usrHash(), the USRs themselves aren't kept
+typedef Hash<uint64_t, Set<Location> > UsrMap;
 typedef Map<Location, Set<Location> > ReferenceMap;
 typedef Map<String, Set<Location> > SymbolNameMap;
 typedef Hash<uint32_t, Set<uint32_t> > DependencyMap;
@@ -60,13 +61,25 @@ typedef Hash<uint32_t, Set<FixIt> > FixItMap;
 typedef Hash<uint32_t, List<String> > DiagnosticsMap;
 
 namespace RTags {
-void dirtySymbolNames(SymbolNameMap &map, const Set<uint32_t> &dirty);
-void dirtySymbols(SymbolMap &map, const Set<uint32_t> &dirty);
-void dirtyUsr(UsrMap &map, const Set<uint32_t> &dirty);
 
 String backtrace(int maxFrames = -1);
 
 
+// 64-bit fnv-1a of a USR, 0 for an empty one. USRs of templated code
+// easily run to hundreds of bytes and with 64 bits a collision is unlikely
+// even with tens of millions of them.
+inline uint64_t usrHash(const char *usr)
+{
+    if (!usr || !*usr)
+        return 0;
+    uint64_t hash = 14695981039346656037ULL;
+    while (*usr) {
+        hash ^= static_cast<unsigned char>(*usr++);
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
 template <typename Container, typename Value>
 inline bool addTo(Container &container, const Value &value)
 {
@@ -188,17 +188,16 @@ SymbolMap::const_iterator findCursorInfo(const SymbolMap &map, const Location &l
     }
 }
 
-void parseTranslationUnit(const Path &sourceFile, const List<String> &args,
-                          CXTranslationUnit &unit, CXIndex index, String &clangLine,
-                          uint32_t fileId, DependencyMap *dependencies,
-                          CXUnsavedFile *unsaved, int unsavedCount)
-
+// fills clangArgs with args followed by the default arguments, returns
+// how many there are
+static int clangArguments(const Path &sourceFile, const List<String> &args, List<const char*> &clangArgs,
+                          String &clangLine, DependencyMap *dependencies)
 {
     clangLine = "clang ";
 
     int idx = 0;
     const List<String> &defaultArguments = Server::instance()->options().defaultArguments;
-    List<const char*> clangArgs(args.size() + defaultArguments.size(), 0);
+    clangArgs.resize(args.size() + defaultArguments.size(), 0);
 
     const List<String> *lists[] = { &args, &defaultArguments };
     for (int i=0; i<2; ++i) {
@@ -222,17 +221,51 @@ void parseTranslationUnit(const Path &sourceFile, const List<String> &args,
     }
 
     clangLine += sourceFile;
+    return idx;
+}
 
-    StopWatch sw;
+static inline unsigned int translationUnitFlags()
+{
     unsigned int flags = CXTranslationUnit_DetailedPreprocessingRecord;
     if (Server::instance()->options().completionCacheSize)
         flags |= CXTranslationUnit_PrecompiledPreamble|CXTranslationUnit_CacheCompletionResults;
+    return flags;
+}
 
+void parseTranslationUnit(const Path &sourceFile, const List<String> &args,
+                          CXTranslationUnit &unit, CXIndex index, String &clangLine,
+                          uint32_t fileId, DependencyMap *dependencies,
+                          CXUnsavedFile *unsaved, int unsavedCount)
+
+{
+    List<const char*> clangArgs;
+    const int count = clangArguments(sourceFile, args, clangArgs, clangLine, dependencies);
+
+    StopWatch sw;
     unit = clang_parseTranslationUnit(index, sourceFile.constData(),
-                                      clangArgs.data(), idx, unsaved, unsavedCount, flags);
+                                      clangArgs.data(), count, unsaved, unsavedCount, translationUnitFlags());
     // error() << sourceFile << sw.elapsed();
 }
 
+void indexTranslationUnit(const Path &sourceFile, const List<String> &args,
+                          CXTranslationUnit &unit, CXIndexAction action,
+                          IndexerCallbacks *callbacks, CXClientData userData, String &clangLine,
+                          uint32_t fileId, DependencyMap *dependencies,
+                          CXUnsavedFile *unsaved, int unsavedCount)
+{
+    List<const char*> clangArgs;
+    const int count = clangArguments(sourceFile, args, clangArgs, clangLine, dependencies);
+
+    unit = 0;
+    if (clang_indexSourceFile(action, userData, callbacks, sizeof(IndexerCallbacks),
+                              CXIndexOpt_SkipParsedBodiesInSession, sourceFile.constData(),
+                              clangArgs.data(), count, unsaved, unsavedCount, &unit,
+                              translationUnitFlags()) && unit) {
+        clang_disposeTranslationUnit(unit);
+        unit = 0;
+    }
+}
+
 void reparseTranslationUnit(CXTranslationUnit &unit, CXUnsavedFile *unsaved, int unsavedCount)
 {
     assert(unit);
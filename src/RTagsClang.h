@@ -41,6 +41,22 @@ inline bool operator!=(CXCursorKind l, const CXCursor &r)
 inline Log operator<<(Log dbg, CXCursor cursor);
 inline Log operator<<(Log dbg, CXCursorKind kind);
 
+// A CXIndexAction, see RTags::indexTranslationUnit()
+class IndexSession
+{
+public:
+    IndexSession(CXIndex index)
+        : mAction(clang_IndexAction_create(index))
+    {}
+    ~IndexSession() { clang_IndexAction_dispose(mAction); }
+    CXIndexAction action() const { return mAction; }
+private:
+    IndexSession(const IndexSession &);
+    IndexSession &operator=(const IndexSession &);
+
+    const CXIndexAction mAction;
+};
+
 namespace RTags {
 
 String eatString(CXString str);
@@ -60,6 +76,15 @@ void parseTranslationUnit(const Path &sourceFile, const List<String> &args,
                           CXTranslationUnit &unit, CXIndex index, String &clangLine,
                           uint32_t fileId, DependencyMap *dependencies,
                           CXUnsavedFile *unsaved, int unsavedCount);
+// Same as parseTranslationUnit() but through clang_indexSourceFile(). Function
+// bodies in headers that were parsed by a translation unit indexed with the
+// same action, and finished before this one started, are skipped. So are the
+// ones in system headers.
+void indexTranslationUnit(const Path &sourceFile, const List<String> &args,
+                          CXTranslationUnit &unit, CXIndexAction action,
+                          IndexerCallbacks *callbacks, CXClientData userData, String &clangLine,
+                          uint32_t fileId, DependencyMap *dependencies,
+                          CXUnsavedFile *unsaved, int unsavedCount);
 void reparseTranslationUnit(CXTranslationUnit &unit, CXUnsavedFile *unsaved, int unsavedCount);
 
 struct Filter
@@ -0,0 +1,212 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "ReferenceGraph.h"
+#include "RTagsClang.h"
+#include <algorithm>
+
+ReferenceGraph::ReferenceGraph(const SymbolMap &map)
+{
+    const int count = map.size();
+    mCursors.reserve(count);
+    for (SymbolMap::const_iterator it = map.begin(); it != map.end(); ++it)
+        mCursors.append(it);
+
+    mTargetRows.reserve(count);
+    mReferenceRows.reserve(count);
+    for (int i=0; i<count; ++i) {
+        mTargetRows.append(mTargets.size());
+        mReferenceRows.append(mReferences.size());
+        addEdges(cursor(i).targets, mTargets);
+        addEdges(cursor(i).references, mReferences);
+    }
+}
+
+int ReferenceGraph::memoryUsage() const
+{
+    return (mCursors.capacity() * sizeof(SymbolMap::const_iterator)
+            + (mTargetRows.capacity() + mReferenceRows.capacity()
+               + mTargets.capacity() + mReferences.capacity()) * sizeof(int));
+}
+
+int ReferenceGraph::lowerBound(const Location &location) const
+{
+    return std::lower_bound(mCursors.begin(), mCursors.end(), location,
+                            [](const SymbolMap::const_iterator &it, const Location &l) {
+                                return it->first < l;
+                            }) - mCursors.begin();
+}
+
+int ReferenceGraph::indexOf(const Location &location) const
+{
+    const int idx = lowerBound(location);
+    return idx < mCursors.size() && this->location(idx) == location ? idx : -1;
+}
+
+// the same match RTags::findCursorInfo() makes without a context, either
+// the cursor at location or the one before it if location is inside its
+// symbol
+int ReferenceGraph::resolve(const Location &location) const
+{
+    const int idx = lowerBound(location);
+    if (idx < mCursors.size() && this->location(idx) == location)
+        return idx;
+    if (idx > 0) {
+        const Location &prev = this->location(idx - 1);
+        if (prev.fileId() == location.fileId()) {
+            const int off = location.offset() - prev.offset();
+            if (cursor(idx - 1).symbolLength > off)
+                return idx - 1;
+        }
+    }
+    return -1;
+}
+
+// Unresolved edges are -1. CursorInfo::targetInfos() returns an empty
+// CursorInfo for those but none of the traversals follow them.
+void ReferenceGraph::addEdges(const LocationSet &locations, List<int> &edges) const
+{
+    for (LocationSet::const_iterator it = locations.begin(); it != locations.end(); ++it)
+        edges.append(resolve(*it));
+}
+
+ReferenceGraph::NodeMap ReferenceGraph::callers(int node) const
+{
+    const unsigned kind = cursor(node).kind;
+    NodeMap ret;
+    const NodeMap cursors = virtuals(location(node), node);
+    for (NodeMap::const_iterator c = cursors.begin(); c != cursors.end(); ++c) {
+        const LocationSet &references = cursor(c->second).references;
+        int i = mReferenceRows.at(c->second);
+        for (LocationSet::const_iterator r = references.begin(); r != references.end(); ++r, ++i) {
+            const int ref = mReferences.at(i);
+            if (ref == -1)
+                continue;
+            const CursorInfo &info = cursor(ref);
+            if (RTags::isReference(info.kind)) { // is this always right?
+                ret[*r] = ref;
+            } else if (kind == CXCursor_Constructor && (info.kind == CXCursor_VarDecl || info.kind == CXCursor_FieldDecl)) {
+                ret[*r] = ref;
+            }
+        }
+    }
+    return ret;
+}
+
+void ReferenceGraph::all(const Location &location, int node, NodeMap &out, Mode mode, unsigned kind) const
+{
+    if (out.contains(location))
+        return;
+    out[location] = node;
+    const CursorInfo &info = cursor(node);
+    int i = mTargetRows.at(node);
+    for (LocationSet::const_iterator it = info.targets.begin(); it != info.targets.end(); ++it, ++i) {
+        const int target = mTargets.at(i);
+        if (target == -1)
+            continue;
+        const CursorInfo &t = cursor(target);
+        bool ok = false;
+        switch (mode) {
+        case VirtualRefs:
+        case NormalRefs:
+            ok = (t.kind == kind);
+            break;
+        case ClassRefs:
+            ok = (t.isClass() || t.kind == CXCursor_Destructor || t.kind == CXCursor_Constructor);
+            break;
+        }
+        if (ok)
+            all(*it, target, out, mode, kind);
+    }
+    i = mReferenceRows.at(node);
+    for (LocationSet::const_iterator it = info.references.begin(); it != info.references.end(); ++it, ++i) {
+        const int ref = mReferences.at(i);
+        if (ref == -1)
+            continue;
+        const CursorInfo &r = cursor(ref);
+        switch (mode) {
+        case NormalRefs:
+            out[*it] = ref;
+            break;
+        case VirtualRefs:
+            if (r.kind == kind) {
+                all(*it, ref, out, mode, kind);
+            } else {
+                out[*it] = ref;
+            }
+            break;
+        case ClassRefs:
+            if (info.isClass())
+                out[*it] = ref;
+            if (r.isClass() || r.kind == CXCursor_Destructor || r.kind == CXCursor_Constructor)
+                all(*it, ref, out, mode, kind);
+            break;
+        }
+    }
+}
+
+ReferenceGraph::NodeMap ReferenceGraph::allReferences(const Location &location, int node) const
+{
+    const CursorInfo &info = cursor(node);
+    Mode mode = NormalRefs;
+    switch (info.kind) {
+    case CXCursor_Constructor:
+    case CXCursor_Destructor:
+        mode = ClassRefs;
+        break;
+    case CXCursor_CXXMethod:
+        mode = VirtualRefs;
+        break;
+    default:
+        mode = info.isClass() ? ClassRefs : VirtualRefs;
+        break;
+    }
+
+    NodeMap ret;
+    all(location, node, ret, mode, info.kind);
+    return ret;
+}
+
+ReferenceGraph::NodeMap ReferenceGraph::allReferences(int node) const
+{
+    return allReferences(location(node), node);
+}
+
+ReferenceGraph::NodeMap ReferenceGraph::virtuals(const Location &location, int node) const
+{
+    const CursorInfo &info = cursor(node);
+    NodeMap ret;
+    ret[location] = node;
+    if (info.kind == CXCursor_CXXMethod) {
+        const NodeMap refs = allReferences(location, node);
+        for (NodeMap::const_iterator it = refs.begin(); it != refs.end(); ++it) {
+            if (cursor(it->second).kind == info.kind)
+                ret[it->first] = it->second;
+        }
+    } else {
+        int i = mTargetRows.at(node);
+        for (LocationSet::const_iterator it = info.targets.begin(); it != info.targets.end(); ++it, ++i) {
+            const int target = mTargets.at(i);
+            if (target != -1 && cursor(target).kind == info.kind)
+                ret[*it] = target;
+        }
+    }
+    return ret;
+}
+
+ReferenceGraph::NodeMap ReferenceGraph::virtuals(int node) const
+{
+    return virtuals(location(node), node);
+}
@@ -0,0 +1,73 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef ReferenceGraph_h
+#define ReferenceGraph_h
+
+#include "CursorInfo.h"
+#include <rct/List.h>
+#include <rct/Map.h>
+
+// The targets and references of every cursor in a SymbolMap, resolved once
+// and stored in compressed sparse row form. Cursors are numbered in map
+// order and each one's edges are a contiguous slice of an edge array, so
+// callers(), allReferences() and virtuals() walk arrays instead of looking
+// up every target and reference in the map. An edge is only the node it
+// resolves to, the location is the one at the same position in the
+// cursor's targets or references.
+//
+// Like FileSymbols this points into the SymbolMap and is only valid until
+// the map changes. It knows nothing about error symbols, lookups in files
+// with errors have to go through CursorInfo.
+class ReferenceGraph
+{
+public:
+    ReferenceGraph(const SymbolMap &map);
+
+    int count() const { return mCursors.size(); }
+    // node of the cursor at location or -1
+    int indexOf(const Location &location) const;
+    const Location &location(int node) const { return mCursors.at(node)->first; }
+    const CursorInfo &cursor(int node) const { return mCursors.at(node)->second; }
+    int edgeCount() const { return mTargets.size() + mReferences.size(); }
+    int memoryUsage() const;
+
+    // the location as stored in the CursorInfos and the node it resolves to
+    typedef Map<Location, int> NodeMap;
+    // same locations as the CursorInfo functions with the same names
+    NodeMap callers(int node) const;
+    NodeMap allReferences(int node) const;
+    NodeMap virtuals(int node) const;
+private:
+    enum Mode {
+        ClassRefs,
+        VirtualRefs,
+        NormalRefs
+    };
+    int lowerBound(const Location &location) const;
+    int resolve(const Location &location) const;
+    void addEdges(const LocationSet &locations, List<int> &edges) const;
+    void all(const Location &location, int node, NodeMap &out, Mode mode, unsigned kind) const;
+    NodeMap allReferences(const Location &location, int node) const;
+    NodeMap virtuals(const Location &location, int node) const;
+
+    List<SymbolMap::const_iterator> mCursors;
+    // edges of node n start at rows[n], one for each location in its
+    // targets or references, -1 if it doesn't resolve
+    List<int> mTargetRows, mReferenceRows;
+    List<int> mTargets, mReferences;
+};
+
+#endif
@@ -18,6 +18,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "RTags.h"
 #include "CursorInfo.h"
 #include "Project.h"
+#include "ReferenceGraph.h"
 
 ReferencesJob::ReferencesJob(const Location &loc, const QueryMessage &query, const std::shared_ptr<Project> &proj)
     : Job(query, 0, proj)
@@ -43,6 +44,8 @@ void ReferencesJob::execute()
             const ErrorSymbolMap &errorMap = proj->errorSymbols();
             const ErrorSymbolMap::const_iterator e = symbolName.isEmpty() ? errorMap.find(locations.begin()->fileId()) : errorMap.end();
             const SymbolMap *errors = e == errorMap.end() ? 0 : &e->second;
+            // the graph doesn't know about error symbols and isn't built while indexing
+            const std::shared_ptr<ReferenceGraph> graph = errors ? std::shared_ptr<ReferenceGraph>() : proj->referenceGraph();
 
             // ### return if e != errorMap && queryFlags() & QueryMessage::AllReferences?
 
@@ -50,7 +53,7 @@ void ReferencesJob::execute()
                 Location pos;
                 SymbolMap::const_iterator found;
                 bool foundInError = false;
-                found = RTags::findCursorInfo(map, *it, context(), errors, &foundInError);
+                found = proj->findCursorInfo(*it, context(), errors, &foundInError);
                 if (found == map.end())
                     continue;
                 pos = found->first;
@@ -62,9 +65,8 @@ void ReferencesJob::execute()
                     if (cursorInfo.isNull() && foundInError)
                         cursorInfo = cursorInfo.bestTarget(e->second, errors, &pos);
                 }
+                const int node = graph ? graph->indexOf(pos) : -1;
                 if (queryFlags() & QueryMessage::AllReferences) {
-                    const SymbolMap all = cursorInfo.allReferences(pos, map, errors);
-
                     bool classRename = false;
                     switch (cursorInfo.kind) {
                     case CXCursor_Constructor:
@@ -76,9 +78,9 @@ void ReferencesJob::execute()
                         break;
                     }
 
-                    for (SymbolMap::const_iterator a = all.begin(); a != all.end(); ++a) {
+                    auto add = [&](const Location &loc, const CursorInfo &info) {
                         if (!classRename) {
-                            references[a->first] = std::make_pair(a->second.isDefinition(), a->second.kind);
+                            references[loc] = std::make_pair(info.isDefinition(), info.kind);
                         } else {
                             enum State {
                                 FoundConstructor = 0x1,
@@ -86,9 +88,9 @@ void ReferencesJob::execute()
                                 FoundReferences = 0x4
                             };
                             unsigned state = 0;
-                            const SymbolMap targets = a->second.targetInfos(map, errors);
+                            const SymbolMap targets = info.targetInfos(map, errors);
                             for (SymbolMap::const_iterator t = targets.begin(); t != targets.end(); ++t) {
-                                if (t->second.kind != a->second.kind)
+                                if (t->second.kind != info.kind)
                                     state |= FoundReferences;
                                 if (t->second.kind == CXCursor_Constructor) {
                                     state |= FoundConstructor;
@@ -97,25 +99,47 @@ void ReferencesJob::execute()
                                 }
                             }
                             if ((state & (FoundConstructor|FoundClass)) != FoundConstructor || !(state & FoundReferences)) {
-                                references[a->first] = std::make_pair(a->second.isDefinition(), a->second.kind);
+                                references[loc] = std::make_pair(info.isDefinition(), info.kind);
                             }
                         }
+                    };
+                    if (node != -1) {
+                        const ReferenceGraph::NodeMap all = graph->allReferences(node);
+                        for (ReferenceGraph::NodeMap::const_iterator a = all.begin(); a != all.end(); ++a)
+                            add(a->first, graph->cursor(a->second));
+                    } else {
+                        const SymbolMap all = cursorInfo.allReferences(pos, map, errors);
+                        for (SymbolMap::const_iterator a = all.begin(); a != all.end(); ++a)
+                            add(a->first, a->second);
                     }
                 } else if (queryFlags() & QueryMessage::FindVirtuals) {
                     // ### not supporting DeclarationOnly
-                    const SymbolMap virtuals = cursorInfo.virtuals(pos, map, errors);
-                    for (SymbolMap::const_iterator v = virtuals.begin(); v != virtuals.end(); ++v) {
-                        references[v->first] = std::make_pair(v->second.isDefinition(), v->second.kind);
+                    if (node != -1) {
+                        const ReferenceGraph::NodeMap virtuals = graph->virtuals(node);
+                        for (ReferenceGraph::NodeMap::const_iterator v = virtuals.begin(); v != virtuals.end(); ++v) {
+                            const CursorInfo &info = graph->cursor(v->second);
+                            references[v->first] = std::make_pair(info.isDefinition(), info.kind);
+                        }
+                    } else {
+                        const SymbolMap virtuals = cursorInfo.virtuals(pos, map, errors);
+                        for (SymbolMap::const_iterator v = virtuals.begin(); v != virtuals.end(); ++v) {
+                            references[v->first] = std::make_pair(v->second.isDefinition(), v->second.kind);
+                        }
                     }
                     startLocation.clear();
                     // since one normall calls this on a declaration it kinda
                     // doesn't work that well do the clever offset thing
                     // underneath
                 } else {
-                    const SymbolMap callers = cursorInfo.callers(pos, map, errors);
-                    for (SymbolMap::const_iterator c = callers.begin(); c != callers.end(); ++c) {
-                        references[c->first] = std::make_pair(false, CXCursor_FirstInvalid);
-                        // For find callers we don't want to prefer definitions or do ranks on cursors
+                    // For find callers we don't want to prefer definitions or do ranks on cursors
+                    if (node != -1) {
+                        const ReferenceGraph::NodeMap callers = graph->callers(node);
+                        for (ReferenceGraph::NodeMap::const_iterator c = callers.begin(); c != callers.end(); ++c)
+                            references[c->first] = std::make_pair(false, CXCursor_FirstInvalid);
+                    } else {
+                        const SymbolMap callers = cursorInfo.callers(pos, map, errors);
+                        for (SymbolMap::const_iterator c = callers.begin(); c != callers.end(); ++c)
+                            references[c->first] = std::make_pair(false, CXCursor_FirstInvalid);
                     }
                 }
             }
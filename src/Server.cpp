@@ -19,6 +19,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "CompletionJob.h"
 #include "CreateOutputMessage.h"
 #include "CursorInfoJob.h"
+#include "DataFile.h"
 #include "DependenciesJob.h"
 #include "Filter.h"
 #include "FindFileJob.h"
@@ -41,6 +42,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "RTags.h"
 #include "ReferencesJob.h"
 #include "StatusJob.h"
+#include "SystemIndex.h"
 #include <clang-c/Index.h>
 #include <rct/Connection.h>
 #include <rct/EventLoop.h>
@@ -52,17 +54,24 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include <rct/Process.h>
 #include <rct/Rct.h>
 #include <rct/RegExp.h>
+#include <rct/StopWatch.h>
 #include <stdio.h>
 
+// Written after the results of queries answered while the project is still
+// being restored. It goes last so clients that look at the first line only
+// see "Project loading" when there were no results at all.
+static const char *IncompleteResults = "Project loading, results may be incomplete";
+
 Server *Server::sInstance = 0;
 Server::Server(const Options &options)
-    : mOptions(options), mVerbose(false), mJobId(0), mIndexerThreadPool(0), mQueryThreadPool(0), mCurrentFileId(0), mIndex(clang_createIndex(0, 1))
+    : mOptions(options), mVerbose(false), mJobId(0), mIndexerThreadPool(0), mQueryThreadPool(0), mIndexerScheduler(0), mCurrentFileId(0), mSavedFileIds(0), mIndex(clang_createIndex(0, 1))
 {
     assert(!sInstance);
     sInstance = this;
 
     mUnloadTimer.timeout().connect(std::bind(&Server::onUnload, this));
     mClearCompletionCacheTimer.timeout().connect(std::bind(&Server::clearCompletionCache, this));
+    mSaveSystemIndexesTimer.timeout().connect(std::bind(&Server::saveSystemIndexes, this));
 }
 
 Server::~Server()
@@ -77,15 +86,22 @@ Server::~Server()
 void Server::clear()
 {
     ThreadPool *indexerThreadPool = 0, *queryThreadPool = 0;
+    IndexerScheduler *indexerScheduler = 0;
     {
         std::lock_guard<std::mutex> lock(mMutex);
         std::swap(indexerThreadPool, mIndexerThreadPool);
         std::swap(queryThreadPool, mQueryThreadPool);
+        std::swap(indexerScheduler, mIndexerScheduler);
     }
 
+    // the slots in the pool stop taking jobs once the queues are empty
+    if (indexerScheduler)
+        indexerScheduler->clear();
     delete indexerThreadPool;
+    delete indexerScheduler;
     delete queryThreadPool;
 
+    saveSystemIndexes();
     Path::rm(mOptions.socketFile);
     mServer.reset();
     mProjects.clear();
@@ -109,6 +125,7 @@ bool Server::init()
     RTags::initMessages();
 
     mIndexerThreadPool = new ThreadPool(mOptions.threadCount);
+    mIndexerScheduler = new IndexerScheduler(mIndexerThreadPool, mOptions.threadCount);
     mQueryThreadPool = new ThreadPool(2);
 
     if (mOptions.options & NoBuiltinIncludes) {
@@ -198,30 +215,13 @@ int Server::reloadProjects()
         Path p = file.mid(mOptions.dataDir.size());
         RTags::decodePath(p);
         if (p.isDir()) {
-            bool remove = false;
-            if (FILE *f = fopen(file.constData(), "r")) {
-                Deserializer in(f);
-                int version;
-                in >> version;
-
-                if (version == Server::DatabaseVersion) {
-                    int fs;
-                    in >> fs;
-                    if (fs != Rct::fileSize(f)) {
-                        error("%s seems to be corrupted, refusing to restore. Removing.",
-                              file.constData());
-                        remove = true;
-                    } else {
-                        addProject(p);
-                    }
-                } else {
-                    remove = true;
-                    error() << file << "has wrong format. Got" << version << "expected" << Server::DatabaseVersion << "Removing";
-                }
-                fclose(f);
-            }
-            if (remove) {
+            DataFile dataFile(file);
+            if (dataFile.open(Server::DatabaseVersion)) {
+                addProject(p);
+            } else {
+                error() << dataFile.errorString() << "Removing.";
                 Path::rm(file);
+                Path::rm(file + ".journal");
             }
         }
     }
@@ -401,6 +401,12 @@ void Server::handleQueryMessage(const QueryMessage &message, Connection *conn)
     case QueryMessage::ReloadProjects:
         reloadProjects(message, conn);
         break;
+    case QueryMessage::ExportIndex:
+        exportIndex(message, conn);
+        break;
+    case QueryMessage::ImportIndex:
+        importIndex(message, conn);
+        break;
     case QueryMessage::Project:
         project(message, conn);
         break;
@@ -473,14 +479,17 @@ void Server::followLocation(const QueryMessage &query, Connection *conn)
         error("No project");
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
     }
 
+    const bool restoring = project->state() == Project::Loading;
     FollowLocationJob job(loc, query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -592,15 +601,18 @@ void Server::cursorInfo(const QueryMessage &query, Connection *conn)
     if (!project) {
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
     }
 
 
+    const bool restoring = project->state() == Project::Loading;
     CursorInfoJob job(loc, query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -617,14 +629,17 @@ void Server::dependencies(const QueryMessage &query, Connection *conn)
     if (!project) {
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
     }
 
+    const bool restoring = project->state() == Project::Loading;
     DependenciesJob job(query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -668,14 +683,17 @@ void Server::referencesForLocation(const QueryMessage &query, Connection *conn)
         error("No project");
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
     }
 
+    const bool restoring = project->state() == Project::Loading;
     ReferencesJob job(loc, query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -689,14 +707,17 @@ void Server::referencesForName(const QueryMessage& query, Connection *conn)
         error("No project");
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
     }
 
+    const bool restoring = project->state() == Project::Loading;
     ReferencesJob job(name, query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -710,14 +731,17 @@ void Server::findSymbols(const QueryMessage &query, Connection *conn)
         error("No project");
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
     }
 
+    const bool restoring = project->state() == Project::Loading;
     FindSymbolsJob job(query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -745,7 +769,7 @@ void Server::status(const QueryMessage &query, Connection *conn)
         error("No project");
         conn->finish();
         return;
-    } else if (project->state() != Project::Loaded) {
+    } else if (!project->isQueryable()) {
         conn->write("Project loading");
         conn->finish();
         return;
@@ -753,8 +777,11 @@ void Server::status(const QueryMessage &query, Connection *conn)
 
     conn->client()->setWriteMode(SocketClient::Synchronous);
 
+    const bool restoring = project->state() == Project::Loading;
     StatusJob job(query, project);
     job.run(conn);
+    if (restoring)
+        conn->write(IncompleteResults);
     conn->finish();
 }
 
@@ -834,6 +861,14 @@ void Server::clearProjects()
     for (ProjectsMap::const_iterator it = mProjects.begin(); it != mProjects.end(); ++it)
         it->second->unload();
     Rct::removeDirectory(mOptions.dataDir);
+    {
+        std::lock_guard<std::mutex> fileIdsLock(mFileIdsMutex);
+        mSavedFileIds = 0;
+    }
+    {
+        std::lock_guard<std::mutex> systemIndexLock(mSystemIndexMutex);
+        mSystemIndexes.clear();
+    }
     mCurrentProject.reset();
     unlink((mOptions.dataDir + ".currentProject").constData());
     mProjects.clear();
@@ -866,11 +901,6 @@ void Server::reindex(const QueryMessage &query, Connection *conn)
     conn->finish();
 }
 
-void Server::startIndexerJob(const std::shared_ptr<ThreadPool::Job> &job)
-{
-    mIndexerThreadPool->start(job);
-}
-
 void Server::startQueryJob(const std::shared_ptr<Job> &job)
 {
     mQueryThreadPool->start(job);
@@ -1062,6 +1092,7 @@ void Server::removeProject(const QueryMessage &query, Connection *conn)
             if (!unload) {
                 RTags::encodePath(path);
                 Path::rm(mOptions.dataDir + path);
+                Path::rm(mOptions.dataDir + path + ".journal");
                 mProjects.erase(cur);
             }
         }
@@ -1081,6 +1112,67 @@ void Server::reloadProjects(const QueryMessage &query, Connection *conn)
     conn->finish();
 }
 
+void Server::exportIndex(const QueryMessage &query, Connection *conn)
+{
+    std::shared_ptr<Project> project = currentProject();
+    if (!project) {
+        conn->write("No project");
+    } else if (project->state() != Project::Loaded) {
+        conn->write("Project loading");
+    } else {
+        const int id = nextId();
+        mPendingLookups[id] = conn;
+        project->exportIndex(query.query(), std::bind(&Server::onExportImportFinished, this, id, std::placeholders::_1));
+        return;
+    }
+    conn->finish();
+}
+
+void Server::importIndex(const QueryMessage &query, Connection *conn)
+{
+    const List<String> args = query.query().split('\n');
+    if (args.size() != 2) {
+        conn->write("Invalid import");
+        conn->finish();
+        return;
+    }
+    const Path file = args.at(0), root = args.at(1);
+    std::shared_ptr<Project> project;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        project = mProjects.value(root);
+        if (project) {
+            project->unload();
+        } else {
+            project = addProject(root);
+        }
+    }
+    const int id = nextId();
+    mPendingLookups[id] = conn;
+    project->importIndex(file, [this, id, project](bool ok, const String &message) {
+            if (ok) {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (!mCurrentProject.lock()) {
+                    mCurrentProject = project;
+                    setupCurrentProjectFile(project);
+                }
+            }
+            onExportImportFinished(id, message);
+        });
+}
+
+// the connection is gone from mPendingLookups if the client went away
+void Server::onExportImportFinished(int id, const String &message)
+{
+    const Hash<int, Connection*>::iterator it = mPendingLookups.find(id);
+    if (it == mPendingLookups.end())
+        return;
+    Connection *conn = it->second;
+    mPendingLookups.erase(it);
+    conn->write(message);
+    conn->finish();
+}
+
 bool Server::selectProject(const Match &match, Connection *conn, unsigned int queryFlags)
 {
     std::lock_guard<std::mutex> lock(mMutex);
@@ -1201,6 +1293,7 @@ void Server::jobCount(const QueryMessage &query, Connection *conn)
         } else {
             mOptions.threadCount = jobCount;
             mIndexerThreadPool->setConcurrentJobs(jobCount);
+            mIndexerScheduler->setMaxJobs(jobCount);
             conn->write<128>("Changed jobs to %d", jobCount);
         }
     }
@@ -1418,10 +1511,7 @@ void Server::handleCompletionMessage(const CompletionMessage &message, Connectio
 
 void Server::startCompletion(const Path &path, int line, int column, int pos, const String &contents, Connection *conn)
 {
-    {
-        std::lock_guard<std::mutex> lock(mMutex);
-        mCurrentFileId = Location::fileId(path);
-    }
+    mCurrentFileId = Location::fileId(path);
 
     // error() << "starting completion" << path << line << column;
     if (!mOptions.completionCacheSize) {
@@ -1492,31 +1582,107 @@ void Server::handleCompletionStream(const CompletionMessage &message, Connection
     mCompletionStreams[client] = conn;
 }
 
+// fileids is an append-only log of the ids created since the previous save:
+//
+// int version
+// n * { uint32_t id, uint32_t length, char path[length] }
+//
+// A torn write at the end, entries written twice and entries that
+// contradict an earlier one are dropped and the file is rewritten on
+// startup, keeping the ids of the good entries.
+static inline void appendFileId(String &out, uint32_t id, const Path &path)
+{
+    const uint32_t header[] = { id, static_cast<uint32_t>(path.size()) };
+    out.append(reinterpret_cast<const char*>(header), sizeof(header));
+    out.append(path);
+}
+
 void Server::restoreFileIds()
 {
     const Path p = mOptions.dataDir + "fileids";
-    if (FILE *f = fopen(p.constData(), "r")) {
-        Hash<Path, uint32_t> pathsToIds;
-        Deserializer in(f);
-        int version;
-        in >> version;
-        if (version == DatabaseVersion) {
-            int size;
-            in >> size;
-            if (size != Rct::fileSize(f)) {
-                error("Refusing to load corrupted file %s", p.constData());
-                clearProjects();
+    const String contents = p.readAll();
+    int version = 0;
+    if (contents.size() < static_cast<int>(sizeof(version))) {
+        clearProjects();
+        return;
+    }
+    memcpy(&version, contents.constData(), sizeof(version));
+    if (version != DatabaseVersion) {
+        error() << p << "has wrong format. Got" << version << "expected" << Server::DatabaseVersion << ", can't restore anything";
+        clearProjects();
+        return;
+    }
+
+    StopWatch timer;
+    Hash<Path, uint32_t> pathsToIds;
+    Hash<uint32_t, Path> idsToPaths;
+    const char *data = contents.constData();
+    const uint32_t size = contents.size();
+    uint32_t pos = sizeof(version), lastId = 0;
+    int skipped = 0;
+    bool compact = false;
+    uint32_t header[2];
+    while (size - pos >= sizeof(header)) {
+        memcpy(header, data + pos, sizeof(header));
+        if (header[1] > size - pos - sizeof(header))
+            break;
+        pos += sizeof(header);
+        const Path path(data + pos, header[1]);
+        const uint32_t id = header[0];
+        pos += header[1];
+        if (!id || id > Location::maxFileId() || path.isEmpty()) {
+            ++skipped;
+            continue;
+        }
+        // the first record for an id or a path wins, the projects have been
+        // using it since then
+        const Hash<uint32_t, Path>::const_iterator existing = idsToPaths.find(id);
+        if (existing != idsToPaths.end()) {
+            if (existing->second == path) {
+                compact = true; // written twice
             } else {
-                in >> pathsToIds;
-                Location::init(pathsToIds);
+                ++skipped;
             }
-        } else {
-            error() << p << "has wrong format. Got" << version << "expected" << Server::DatabaseVersion << ", can't restore anything";
-            clearProjects();
+            continue;
+        }
+        if (pathsToIds.contains(path)) {
+            ++skipped;
+            continue;
+        }
+        pathsToIds[path] = id;
+        idsToPaths[id] = path;
+        lastId = std::max(lastId, id);
+    }
+    if (pos != size) {
+        error() << "Discarding" << (size - pos) << "bytes of incomplete entries in" << p;
+        compact = true;
+    }
+    if (skipped) {
+        error() << "Skipped" << skipped << "bad entries in" << p;
+        compact = true;
+    }
+    // ids that were skipped are left unused rather than handed out again,
+    // files that still refer to them are simply not found
+    Location::init(pathsToIds);
+
+    if (compact) {
+        // pathsSince() returns the paths by id, the unused ones are empty
+        const List<Path> paths = Location::pathsSince(0, &lastId);
+        String out(reinterpret_cast<const char*>(&version), sizeof(version));
+        for (int i=0; i<paths.size(); ++i) {
+            if (!paths.at(i).isEmpty())
+                appendFileId(out, i + 1, paths.at(i));
+        }
+        const Path tmp = p + ".tmp";
+        FILE *f = fopen(tmp.constData(), "w");
+        if (!f || fwrite(out.constData(), out.size(), 1, f) != 1 || fclose(f) || rename(tmp.constData(), p.constData())) {
+            // the ids are loaded, the log is repaired the same way next time
+            error("Failed to compact %s", p.constData());
+            Path::rm(tmp);
         }
-        fclose(f);
     }
-    else { clearProjects(); }
+    mSavedFileIds = lastId;
+    warning() << "Restored" << lastId << "file ids in" << timer.elapsed() << "ms";
 }
 
 bool Server::saveFileIds() const
@@ -1525,24 +1691,88 @@ bool Server::saveFileIds() const
         error("Can't create directory [%s]", mOptions.dataDir.constData());
         return false;
     }
+    std::lock_guard<std::mutex> lock(mFileIdsMutex);
+    uint32_t lastId;
+    const List<Path> paths = Location::pathsSince(mSavedFileIds, &lastId);
+    if (paths.isEmpty() && mSavedFileIds)
+        return true;
+
+    String out;
+    if (!mSavedFileIds) {
+        const int version = DatabaseVersion;
+        out.append(reinterpret_cast<const char*>(&version), sizeof(version));
+    }
+    for (int i=0; i<paths.size(); ++i)
+        appendFileId(out, mSavedFileIds + i + 1, paths.at(i));
+
     const Path p = mOptions.dataDir + "fileids";
-    FILE *f = fopen(p.constData(), "w");
+    FILE *f = fopen(p.constData(), mSavedFileIds ? "a" : "w");
     if (!f) {
         error("Can't open file %s", p.constData());
         return false;
     }
-    const Hash<Path, uint32_t> pathsToIds = Location::pathsToIds();
-    Serializer out(f);
-    out << static_cast<int>(DatabaseVersion);
-    const int pos = ftell(f);
-    out << static_cast<int>(0) << pathsToIds;
-    const int size = ftell(f);
-    fseek(f, pos, SEEK_SET);
-    out << size;
-    fclose(f);
+    const bool ok = fwrite(out.constData(), out.size(), 1, f) == 1;
+    if (fclose(f) || !ok) {
+        error("Failed to write %s", p.constData());
+        return false;
+    }
+    mSavedFileIds = lastId;
     return true;
 }
 
+std::shared_ptr<SystemIndex> Server::systemIndex(const SourceInformation &source)
+{
+    if (mOptions.options & NoSharedSystemIndex)
+        return std::shared_ptr<SystemIndex>();
+    return systemIndex(SystemIndex::key(source));
+}
+
+std::shared_ptr<SystemIndex> Server::systemIndex(const String &key)
+{
+    if (mOptions.options & NoSharedSystemIndex || key.isEmpty())
+        return std::shared_ptr<SystemIndex>();
+    std::lock_guard<std::mutex> lock(mSystemIndexMutex);
+    std::shared_ptr<SystemIndex> &index = mSystemIndexes[key];
+    if (!index) {
+        index.reset(new SystemIndex(key));
+        if (index->restore())
+            warning() << "Restored system index" << key << "with" << index->count() << "files";
+    }
+    return index;
+}
+
+void Server::removeSystemFile(uint32_t fileId)
+{
+    std::lock_guard<std::mutex> lock(mSystemIndexMutex);
+    for (Hash<String, std::shared_ptr<SystemIndex> >::const_iterator it = mSystemIndexes.begin(); it != mSystemIndexes.end(); ++it)
+        it->second->remove(fileId);
+}
+
+void Server::systemIndexChanged()
+{
+    enum { SaveSystemIndexesTimeout = 5000 };
+    mSaveSystemIndexesTimer.restart(SaveSystemIndexesTimeout, Timer::SingleShot);
+}
+
+void Server::saveSystemIndexes()
+{
+    List<std::shared_ptr<SystemIndex> > indexes;
+    {
+        std::lock_guard<std::mutex> lock(mSystemIndexMutex);
+        for (Hash<String, std::shared_ptr<SystemIndex> >::const_iterator it = mSystemIndexes.begin(); it != mSystemIndexes.end(); ++it)
+            indexes.append(it->second);
+    }
+    if (!saveFileIds())
+        return;
+    for (int i=0; i<indexes.size(); ++i) {
+        if (indexes.at(i)->isDirty()) {
+            StopWatch timer;
+            if (indexes.at(i)->save())
+                warning() << "Saved system index" << indexes.at(i)->key() << "in" << timer.elapsed() << "ms";
+        }
+    }
+}
+
 void Server::onUnload()
 {
     std::lock_guard<std::mutex> lock(mMutex);
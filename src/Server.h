@@ -21,6 +21,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "CreateOutputMessage.h"
 #include "CompletionMessage.h"
 #include "FileManager.h"
+#include "IndexerScheduler.h"
 #include "QueryMessage.h"
 #include "RTagsClang.h"
 #include "RTags.h"
@@ -34,6 +35,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include <rct/Timer.h>
 #include <rct/ThreadPool.h>
 #include <rct/SocketServer.h>
+#include <atomic>
 #include <mutex>
 
 class Connection;
@@ -46,10 +48,12 @@ class Job;
 class JobOutput;
 class Project;
 class IndexerJob;
+class SourceInformation;
+class SystemIndex;
 class Server
 {
 public:
-    enum { DatabaseVersion = 28 };
+    enum { DatabaseVersion = 37 };
 
     struct Options {
         Options()
@@ -80,15 +84,34 @@ public:
         WatchSystemPaths = 0x0200,
         NoFileManagerWatch = 0x0400,
         NoEsprima = 0x0800,
-        UseCompilerFlags = 0x1000
+        UseCompilerFlags = 0x1000,
+        NoSharedSystemIndex = 0x2000,
+        SkipParsedBodies = 0x4000
     };
     ThreadPool *threadPool() const { return mIndexerThreadPool; }
     void startQueryJob(const std::shared_ptr<Job> &job);
-    void startIndexerJob(const std::shared_ptr<ThreadPool::Job> &job);
+    // IndexerJob or ReparseJob
+    template <typename T>
+    void startIndexerJob(const std::shared_ptr<T> &job, IndexerScheduler::Level level)
+    {
+        mIndexerScheduler->start(level, [job]() { job->run(); });
+    }
+    IndexerScheduler::Status indexerStatus() const { return mIndexerScheduler->status(); }
     bool init();
     const Options &options() const { return mOptions; }
-    uint32_t currentFileId() const { std::lock_guard<std::mutex> lock(mMutex); return mCurrentFileId; }
+    typedef Hash<Path, std::shared_ptr<Project> > ProjectsMap;
+    ProjectsMap projects() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mProjects;
+    }
+    // not under mMutex, Project::index() asks for it while Server::index() holds it
+    uint32_t currentFileId() const { return mCurrentFileId; }
     bool saveFileIds() const;
+    std::shared_ptr<SystemIndex> systemIndex(const SourceInformation &source);
+    std::shared_ptr<SystemIndex> systemIndex(const String &key);
+    void removeSystemFile(uint32_t fileId);
+    void systemIndexChanged();
     RTagsPluginFactory &factory() { return mPluginFactory; }
     void onJobOutput(JobOutput&& out);
     CXIndex clangIndex() const { return mIndex; }
@@ -99,6 +122,7 @@ private:
     bool isCompletionStream(Connection* conn) const;
 
     void clearCompletionCache();
+    void saveSystemIndexes();
     void restoreFileIds();
     void clear();
     void onNewConnection();
@@ -138,6 +162,9 @@ private:
     void dumpFile(const QueryMessage &query, Connection *conn);
     void removeProject(const QueryMessage &query, Connection *conn);
     void reloadProjects(const QueryMessage &query, Connection *conn);
+    void exportIndex(const QueryMessage &query, Connection *conn);
+    void importIndex(const QueryMessage &query, Connection *conn);
+    void onExportImportFinished(int id, const String &message);
     void project(const QueryMessage &query, Connection *conn);
     void clearProjects(const QueryMessage &query, Connection *conn);
     void loadCompilationDatabase(const QueryMessage &query, Connection *conn);
@@ -159,7 +186,6 @@ private:
     void onCompletionJobFinished(Path path, int id);
     void startCompletion(const Path &path, int line, int column, int pos, const String &contents, Connection *conn);
 
-    typedef Hash<Path, std::shared_ptr<Project> > ProjectsMap;
     ProjectsMap mProjects;
     std::weak_ptr<Project> mCurrentProject;
 
@@ -171,6 +197,7 @@ private:
     int mJobId;
 
     ThreadPool *mIndexerThreadPool, *mQueryThreadPool;
+    IndexerScheduler *mIndexerScheduler;
     Signal<std::function<void(int, const List<String> &)> > mComplete;
 
     Hash<SocketClient::SharedPtr, Connection*> mCompletionStreams;
@@ -186,14 +213,22 @@ private:
     Hash<Path, PendingCompletion> mPendingCompletions;
     Set<Path> mActiveCompletions;
 
-    Timer mUnloadTimer, mClearCompletionCacheTimer;
+    Timer mUnloadTimer, mClearCompletionCacheTimer, mSaveSystemIndexesTimer;
 
     RTagsPluginFactory mPluginFactory;
 
-    uint32_t mCurrentFileId;
+    std::atomic<uint32_t> mCurrentFileId;
 
     mutable std::mutex mMutex;
 
+    // ids up to this one are in the fileids log
+    mutable std::mutex mFileIdsMutex;
+    mutable uint32_t mSavedFileIds;
+
+    // keyed by SystemIndex::key()
+    mutable std::mutex mSystemIndexMutex;
+    Hash<String, std::shared_ptr<SystemIndex> > mSystemIndexes;
+
     CXIndex mIndex;
 };
 
@@ -19,6 +19,9 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "Server.h"
 #include <clang-c/Index.h>
 #include "Project.h"
+#include "SymbolNameIndex.h"
+#include "SystemIndex.h"
+#include <rct/MemoryMonitor.h>
 
 const char *StatusJob::delimiter = "*********************************";
 StatusJob::StatusJob(const QueryMessage &q, const std::shared_ptr<Project> &project)
@@ -29,7 +32,7 @@ StatusJob::StatusJob(const QueryMessage &q, const std::shared_ptr<Project> &proj
 void StatusJob::execute()
 {
     bool matched = false;
-    const char *alternatives = "fileids|dependencies|fileinfos|symbols|symbolnames|errorsymbols|watchedpaths|compilers";
+    const char *alternatives = "fileids|dependencies|fileinfos|symbols|symbolnames|errorsymbols|watchedpaths|compilers|memory|jobs";
     if (!strcasecmp(query.constData(), "fileids")) {
         matched = true;
         if (!write(delimiter) || !write("fileids") || !write(delimiter))
@@ -43,6 +46,21 @@ void StatusJob::execute()
             return;
     }
 
+    if (query.isEmpty() || !strcasecmp(query.constData(), "jobs")) {
+        matched = true;
+        if (!write(delimiter) || !write("jobs") || !write(delimiter))
+            return;
+        const IndexerScheduler::Status status = Server::instance()->indexerStatus();
+        if (!write<128>("  running: %d/%d", status.running, status.maxJobs))
+            return;
+        for (int i=0; i<IndexerScheduler::LevelCount; ++i) {
+            if (!write<128>("  %s: %d queued", IndexerScheduler::levelName(static_cast<IndexerScheduler::Level>(i)), status.queued[i]))
+                return;
+        }
+        if (!write<128>("  aged: %llu", static_cast<unsigned long long>(status.aged)))
+            return;
+    }
+
     std::shared_ptr<Project> proj = project();
     if (!proj) {
         if (!matched)
@@ -144,13 +162,13 @@ void StatusJob::execute()
 
     if (query.isEmpty() || !strcasecmp(query.constData(), "symbolnames")) {
         matched = true;
-        const SymbolNameMap &map = proj->symbolNames();
+        const std::shared_ptr<SymbolNameIndex> index = proj->symbolNameIndex();
         write(delimiter);
         write("symbolnames");
         write(delimiter);
-        for (SymbolNameMap::const_iterator it = map.begin(); it != map.end(); ++it) {
-            write<128>("  %s", it->first.constData());
-            const Set<Location> &locations = it->second;
+        for (SymbolNameIndex::const_iterator it = index->begin(); it != index->end(); ++it) {
+            write<128>("  %s", SymbolNameIndex::name(it).constData());
+            const Set<Location> &locations = SymbolNameIndex::locations(it);
             for (Set<Location>::const_iterator lit = locations.begin(); lit != locations.end(); ++lit) {
                 const Location &loc = *lit;
                 write<1024>("    %s", loc.key().constData());
@@ -180,4 +198,38 @@ void StatusJob::execute()
                 return;
         }
     }
+
+    if (query.isEmpty() || !strcasecmp(query.constData(), "memory")) {
+        matched = true;
+        if (!write(delimiter) || !write("memory") || !write(delimiter))
+            return;
+        const Server::ProjectsMap projects = Server::instance()->projects();
+        Set<const SystemShard*> shards;
+        uint64_t shardBytes = 0;
+        for (Server::ProjectsMap::const_iterator p = projects.begin(); p != projects.end(); ++p) {
+            if (!write<512>("  %s%s", p->first.constData(), p->second == proj ? " (current)" : ""))
+                return;
+            const List<Project::MemoryUsage> usage = p->second->memoryUsage();
+            uint64_t total = 0;
+            for (List<Project::MemoryUsage>::const_iterator it = usage.begin(); it != usage.end(); ++it) {
+                if (!write<256>("    %s: %d entries, %.1fmb", it->name, it->count, it->bytes / (1024.0 * 1024.0)))
+                    return;
+                total += it->bytes;
+            }
+            if (!write<256>("    total: %.1fmb", total / (1024.0 * 1024.0)))
+                return;
+            const List<std::shared_ptr<const SystemShard> > projectShards = p->second->systemShards();
+            for (int i=0; i<projectShards.size(); ++i) {
+                if (shards.insert(projectShards.at(i).get()))
+                    shardBytes += projectShards.at(i)->memoryUsage();
+            }
+        }
+        // shared by all projects
+        if (!write<256>("  system index: %d files, %.1fmb", shards.size(), shardBytes / (1024.0 * 1024.0))
+            || !write<256>("  fileids: %d entries, %.1fmb", Location::fileCount(), Location::memoryUsage() / (1024.0 * 1024.0))
+            || !write<256>("  symbolname pool: %d entries, %.1fmb", SymbolName::count(), SymbolName::memoryUsage() / (1024.0 * 1024.0))
+            || !write<256>("  process: %.1fmb", MemoryMonitor::usage() / (1024.0 * 1024.0))) {
+            return;
+        }
+    }
 }
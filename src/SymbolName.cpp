@@ -0,0 +1,60 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "SymbolName.h"
+#include "InternTable.h"
+
+// Every cursor's name goes through the pool, the indexers intern them and
+// the queries read them. The table is constant initialized, static
+// CursorInfos can intern names before this file's dynamic initializers would
+// have run.
+static InternTable<String, 14, true> sNames;
+
+const String SymbolName::sEmpty;
+
+uint32_t SymbolName::insert(const String &name)
+{
+    if (name.isEmpty())
+        return 0;
+    const uint32_t id = sNames.insert(name);
+    if (!id)
+        error() << "Symbol name pool is full, dropping" << name;
+    return id;
+}
+
+void SymbolName::retain(uint32_t id)
+{
+    sNames.retain(id);
+}
+
+void SymbolName::release(uint32_t id)
+{
+    sNames.release(id);
+}
+
+const String &SymbolName::name(uint32_t id)
+{
+    return sNames.at(id);
+}
+
+int SymbolName::count()
+{
+    return sNames.count();
+}
+
+uint64_t SymbolName::memoryUsage()
+{
+    return sNames.memoryUsage();
+}
@@ -0,0 +1,127 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SymbolName_h
+#define SymbolName_h
+
+#include <rct/Log.h>
+#include <rct/Serializer.h>
+#include <rct/String.h>
+#include <utility>
+
+// Symbol names are interned in a process wide pool and cursors refer to
+// them by a 32-bit id. Most cursors are references carrying the same fully
+// qualified name as their target so this keeps a single copy of each name
+// no matter how many cursors, projects or jobs use it. Each SymbolName holds
+// a reference on its name and a name goes away with its last user, looking
+// one up doesn't lock, see InternTable.h.
+class SymbolName
+{
+public:
+    SymbolName()
+        : mId(0)
+    {}
+    SymbolName(const String &name)
+        : mId(insert(name))
+    {}
+    SymbolName(const char *name)
+        : mId(insert(String(name)))
+    {}
+    SymbolName(const SymbolName &other)
+        : mId(other.mId)
+    {
+        if (mId)
+            retain(mId);
+    }
+    SymbolName(SymbolName &&other)
+        : mId(other.mId)
+    {
+        other.mId = 0;
+    }
+    ~SymbolName()
+    {
+        if (mId)
+            release(mId);
+    }
+
+    SymbolName &operator=(const SymbolName &other)
+    {
+        if (other.mId)
+            retain(other.mId);
+        if (mId)
+            release(mId);
+        mId = other.mId;
+        return *this;
+    }
+    SymbolName &operator=(SymbolName &&other)
+    {
+        std::swap(mId, other.mId);
+        return *this;
+    }
+
+    uint32_t id() const { return mId; }
+    const String &string() const { return mId ? name(mId) : sEmpty; }
+    operator const String &() const { return string(); }
+
+    bool isEmpty() const { return !mId; }
+    int size() const { return string().size(); }
+    const char *constData() const { return string().constData(); }
+    bool contains(const String &str) const { return string().contains(str); }
+    void clear()
+    {
+        if (mId)
+            release(mId);
+        mId = 0;
+    }
+
+    bool operator==(const SymbolName &other) const { return mId == other.mId; }
+    bool operator!=(const SymbolName &other) const { return mId != other.mId; }
+
+    // number of names in the pool and the memory they take up
+    static int count();
+    static uint64_t memoryUsage();
+private:
+    static uint32_t insert(const String &name);
+    static void retain(uint32_t id);
+    static void release(uint32_t id);
+    static const String &name(uint32_t id);
+
+    uint32_t mId;
+
+    static const String sEmpty;
+};
+
+static inline Log operator<<(Log dbg, const SymbolName &name)
+{
+    dbg << name.string();
+    return dbg;
+}
+
+// the ids are only meaningful to this process, the names are written out
+template <> inline Serializer &operator<<(Serializer &s, const SymbolName &t)
+{
+    s << t.string();
+    return s;
+}
+
+template <> inline Deserializer &operator>>(Deserializer &s, SymbolName &t)
+{
+    String name;
+    s >> name;
+    t = name;
+    return s;
+}
+
+#endif
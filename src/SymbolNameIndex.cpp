@@ -0,0 +1,247 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "SymbolNameIndex.h"
+#include <algorithm>
+#include <string.h>
+
+int SymbolNameIndex::compare(const Parts &l, const Parts &r)
+{
+    int lp = 0, lo = 0, rp = 0, ro = 0;
+    while (true) {
+        while (lp < 2 && lo == l.size[lp]) {
+            ++lp;
+            lo = 0;
+        }
+        while (rp < 2 && ro == r.size[rp]) {
+            ++rp;
+            ro = 0;
+        }
+        if (lp == 2)
+            return rp == 2 ? 0 : -1;
+        if (rp == 2)
+            return 1;
+        const int count = std::min(l.size[lp] - lo, r.size[rp] - ro);
+        const int cmp = memcmp(l.data[lp] + lo, r.data[rp] + ro, count);
+        if (cmp)
+            return cmp;
+        lo += count;
+        ro += count;
+    }
+}
+
+String SymbolNameIndex::key(const String &type, const char *name, int length, bool parameter)
+{
+    String ret;
+    if (!type.isEmpty()) {
+        ret.reserve(type.size() + 1 + length);
+        ret += type;
+        ret += static_cast<char>(parameter ? ParameterTypeSeparator : TypeSeparator);
+    }
+    ret.append(name, length);
+    return ret;
+}
+
+SymbolNameIndex::Parts SymbolNameIndex::parts(const Entry &entry)
+{
+    const String &key = entry.name->first;
+    const Parts ret = {
+        { key.constData(), key.constData() + entry.offset },
+        { static_cast<int>(entry.typeLength), static_cast<int>(key.size() - entry.offset) }
+    };
+    return ret;
+}
+
+SymbolNameIndex::Parts SymbolNameIndex::parts(const String &name)
+{
+    const Parts ret = { { name.constData(), name.constData() }, { 0, name.size() } };
+    return ret;
+}
+
+template <typename Func>
+void SymbolNameIndex::visitEntries(SymbolNameMap::const_iterator name, Func func)
+{
+    const String &key = name->first;
+    const char *data = key.constData();
+    uint32_t typeLength = 0, start = 0;
+    bool parameter = false;
+    for (int i=0; i<key.size(); ++i) {
+        if (data[i] == TypeSeparator || data[i] == ParameterTypeSeparator) {
+            typeLength = i;
+            start = i + 1;
+            parameter = data[i] == ParameterTypeSeparator;
+            break;
+        }
+    }
+    const char *ch = data + start;
+    while (true) {
+        const uint32_t offset = ch - data;
+        const Entry entry = { &*name, 0, offset, false };
+        func(entry);
+        if (typeLength && (!parameter || !strchr(ch, '('))) {
+            const Entry typed = { &*name, typeLength, offset, false };
+            func(typed);
+        }
+        ch = strstr(ch + 1, "::");
+        if (!ch)
+            break;
+        ch += 2;
+    }
+}
+
+SymbolNameIndex::SymbolNameIndex(const SymbolNameMap &map)
+    : mRemoved(0)
+{
+    for (SymbolNameMap::const_iterator it = map.begin(); it != map.end(); ++it)
+        visitEntries(it, [this](const Entry &entry) { mEntries.append(entry); });
+    std::sort(mEntries.begin(), mEntries.end(), lessThan);
+}
+
+void SymbolNameIndex::insert(SymbolNameMap::const_iterator name)
+{
+    visitEntries(name, [this](const Entry &entry) { mPending.append(entry); });
+}
+
+void SymbolNameIndex::remove(SymbolNameMap::const_iterator name)
+{
+    commit();
+    const SymbolNameMap::value_type *copy = 0;
+    visitEntries(name, [&](const Entry &entry) {
+            // other names can have the same suffix
+            List<Entry>::iterator it = std::lower_bound(mAdded.begin(), mAdded.end(), entry, lessThan);
+            for (; it != mAdded.end() && !lessThan(entry, *it); ++it) {
+                if (it->name == entry.name && it->typeLength == entry.typeLength && it->offset == entry.offset) {
+                    mAdded.erase(it);
+                    return;
+                }
+            }
+            it = std::lower_bound(mEntries.begin(), mEntries.end(), entry, lessThan);
+            for (; it != mEntries.end() && !lessThan(entry, *it); ++it) {
+                if (it->name == entry.name && it->typeLength == entry.typeLength && it->offset == entry.offset) {
+                    // the key is about to go away, the entry still has to sort the same way
+                    if (!copy) {
+                        mRemovedNames.push_back(SymbolNameMap::value_type(name->first, Set<Location>()));
+                        copy = &mRemovedNames.back();
+                    }
+                    it->name = copy;
+                    it->removed = true;
+                    ++mRemoved;
+                    return;
+                }
+            }
+        });
+    if ((mAdded.size() + mRemoved) * MergeRatio > mEntries.size())
+        merge();
+}
+
+void SymbolNameIndex::commit()
+{
+    if (mPending.isEmpty())
+        return;
+    std::sort(mPending.begin(), mPending.end(), lessThan);
+    const int size = mAdded.size();
+    mAdded.insert(mAdded.end(), mPending.begin(), mPending.end());
+    std::inplace_merge(mAdded.begin(), mAdded.begin() + size, mAdded.end(), lessThan);
+    mPending.clear();
+    if ((mAdded.size() + mRemoved) * MergeRatio > mEntries.size())
+        merge();
+}
+
+void SymbolNameIndex::merge()
+{
+    List<Entry> entries;
+    entries.reserve(mEntries.size() - mRemoved + mAdded.size());
+    List<Entry>::const_iterator added = mAdded.begin();
+    const List<Entry>::const_iterator addedEnd = mAdded.end();
+    for (List<Entry>::const_iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+        if (it->removed)
+            continue;
+        while (added != addedEnd && lessThan(*added, *it))
+            entries.append(*added++);
+        entries.append(*it);
+    }
+    entries.insert(entries.end(), added, addedEnd);
+    mEntries.swap(entries);
+    mAdded.clear();
+    mRemoved = 0;
+    mRemovedNames.clear();
+}
+
+uint64_t SymbolNameIndex::memoryUsage() const
+{
+    uint64_t ret = (mEntries.capacity() + mAdded.capacity() + mPending.capacity()) * sizeof(Entry);
+    for (std::deque<SymbolNameMap::value_type>::const_iterator it = mRemovedNames.begin(); it != mRemovedNames.end(); ++it)
+        ret += sizeof(SymbolNameMap::value_type) + it->first.size();
+    return ret;
+}
+
+void SymbolNameIndex::const_iterator::settle()
+{
+    while (mEntries != mEntriesEnd && mEntries->removed)
+        ++mEntries;
+    if (mAdded == mAddedEnd) {
+        mEntry = mEntries != mEntriesEnd ? mEntries : 0;
+    } else if (mEntries == mEntriesEnd || !lessThan(*mEntries, *mAdded)) {
+        mEntry = mAdded;
+    } else {
+        mEntry = mEntries;
+    }
+}
+
+SymbolNameIndex::const_iterator SymbolNameIndex::begin() const
+{
+    return const_iterator(mAdded.data(), mAdded.data() + mAdded.size(),
+                          mEntries.data(), mEntries.data() + mEntries.size());
+}
+
+SymbolNameIndex::const_iterator SymbolNameIndex::end() const
+{
+    const Entry *added = mAdded.data() + mAdded.size(), *entries = mEntries.data() + mEntries.size();
+    return const_iterator(added, added, entries, entries);
+}
+
+SymbolNameIndex::const_iterator SymbolNameIndex::lowerBound(const String &name) const
+{
+    const Parts needle = parts(name);
+    auto before = [](const Entry &entry, const Parts &p) { return compare(parts(entry), p) < 0; };
+    const Entry *added = mAdded.data(), *addedEnd = added + mAdded.size();
+    const Entry *entries = mEntries.data(), *entriesEnd = entries + mEntries.size();
+    return const_iterator(std::lower_bound(added, addedEnd, needle, before), addedEnd,
+                          std::lower_bound(entries, entriesEnd, needle, before), entriesEnd);
+}
+
+bool SymbolNameIndex::startsWith(const_iterator it, const String &prefix)
+{
+    Parts p = parts(*it);
+    if (p.length() < prefix.size())
+        return false;
+    // cut the name down to the length of prefix
+    int remaining = prefix.size();
+    for (int i=0; i<2; ++i) {
+        p.size[i] = std::min(p.size[i], remaining);
+        remaining -= p.size[i];
+    }
+    return !compare(p, parts(prefix));
+}
+
+String SymbolNameIndex::name(const_iterator it)
+{
+    const Parts p = parts(*it);
+    String ret;
+    ret.reserve(p.length());
+    ret.append(p.data[0], p.size[0]);
+    ret.append(p.data[1], p.size[1]);
+    return ret;
+}
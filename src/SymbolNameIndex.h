@@ -0,0 +1,135 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SymbolNameIndex_h
+#define SymbolNameIndex_h
+
+#include "RTags.h"
+#include <rct/List.h>
+#include <rct/String.h>
+#include <deque>
+
+// The indexers store one symbol name per cursor, qualified as far as it
+// goes, e.g. "int ns::Foo::bar" is stored as "int \x01ns::Foo::bar". The
+// names it can be looked up by, "bar", "Foo::bar", "int bar" and so on, are
+// generated here when the project is queried.
+//
+// An entry is the suffix of a stored name that starts after a "::",
+// optionally with the type in front. Nothing is copied, entries point into
+// the SymbolNameMap. The index is kept up to date as names are inserted and
+// erased, so like mSymbolNames it's only changed on the main thread.
+//
+// Entries live in a sorted array with a smaller sorted array of the ones
+// added since it was last rebuilt, lookups walk both. Inserted names are
+// sorted into the second one by commit(). Removed entries of the big array
+// are only marked and point to a copy of their key until the arrays are
+// merged again, which happens once the changes reach 1/MergeRatio of it.
+class SymbolNameIndex
+{
+    struct Entry {
+        const SymbolNameMap::value_type *name;
+        uint32_t typeLength; // 0 if there's no type in front
+        uint32_t offset : 31; // where the suffix starts in the key
+        uint32_t removed : 1;
+    };
+    // a name is the type followed by the suffix
+    struct Parts {
+        const char *data[2];
+        int size[2];
+
+        int length() const { return size[0] + size[1]; }
+    };
+public:
+    enum {
+        // the type applies to all the suffixes
+        TypeSeparator = '\x01',
+        // the type only applies to the suffixes without a function in them,
+        // "int bar" but not "int foo(int)::bar" for a parameter
+        ParameterTypeSeparator = '\x02'
+    };
+    enum { MergeRatio = 8 };
+    // the name the indexers store for a symbol
+    static String key(const String &type, const char *name, int length, bool parameter);
+
+    SymbolNameIndex(const SymbolNameMap &map);
+
+    // call after name was inserted into the map and before it's erased,
+    // inserted names are only found after the next commit()
+    void insert(SymbolNameMap::const_iterator name);
+    void remove(SymbolNameMap::const_iterator name);
+    void commit();
+
+    class const_iterator
+    {
+    public:
+        const_iterator()
+            : mEntry(0), mAdded(0), mAddedEnd(0), mEntries(0), mEntriesEnd(0)
+        {}
+
+        const Entry &operator*() const { return *mEntry; }
+        const Entry *operator->() const { return mEntry; }
+        const_iterator &operator++()
+        {
+            if (mAdded != mAddedEnd && mEntry == mAdded) {
+                ++mAdded;
+            } else {
+                ++mEntries;
+            }
+            settle();
+            return *this;
+        }
+        bool operator==(const const_iterator &other) const
+        {
+            return mAdded == other.mAdded && mEntries == other.mEntries;
+        }
+        bool operator!=(const const_iterator &other) const { return !operator==(other); }
+    private:
+        friend class SymbolNameIndex;
+        const_iterator(const Entry *added, const Entry *addedEnd, const Entry *entries, const Entry *entriesEnd)
+            : mEntry(0), mAdded(added), mAddedEnd(addedEnd), mEntries(entries), mEntriesEnd(entriesEnd)
+        {
+            settle();
+        }
+        void settle();
+
+        const Entry *mEntry, *mAdded, *mAddedEnd, *mEntries, *mEntriesEnd;
+    };
+
+    int count() const { return mEntries.size() - mRemoved + mAdded.size() + mPending.size(); }
+    // the entries and the copies of removed keys, the names themselves belong to the map
+    uint64_t memoryUsage() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+    // first entry that doesn't sort before name
+    const_iterator lowerBound(const String &name) const;
+    static bool startsWith(const_iterator it, const String &prefix);
+    static String name(const_iterator it);
+    static const Set<Location> &locations(const_iterator it) { return it->name->second; }
+private:
+    template <typename Func>
+    static void visitEntries(SymbolNameMap::const_iterator name, Func func);
+    static Parts parts(const Entry &entry);
+    static Parts parts(const String &name);
+    static int compare(const Parts &l, const Parts &r);
+    static bool lessThan(const Entry &l, const Entry &r) { return compare(parts(l), parts(r)) < 0; }
+    void merge();
+
+    List<Entry> mEntries, mAdded, mPending;
+    int mRemoved; // marked entries in mEntries
+    // keys of the marked entries, deque doesn't move them
+    std::deque<SymbolNameMap::value_type> mRemovedNames;
+};
+
+#endif
@@ -0,0 +1,296 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "SystemIndex.h"
+#include "DataFile.h"
+#include "IndexerJob.h"
+#include "Server.h"
+#include "SourceInformation.h"
+#include "SymbolNameIndex.h"
+#include <rct/Log.h>
+
+// fnv-1a, the key ends up in a file name so it has to be stable
+static inline uint64_t hashString(const String &string, uint64_t hash = 14695981039346656037ULL)
+{
+    const char *data = string.constData();
+    for (int i=0; i<string.size(); ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename Shard, typename T, typename U>
+static inline void splitLocations(const T &map, U Shard::*member, Hash<uint32_t, Shard> &shards)
+{
+    for (typename T::const_iterator it = map.begin(); it != map.end(); ++it) {
+        for (typename T::mapped_type::const_iterator l = it->second.begin(); l != it->second.end(); ++l) {
+            const typename Hash<uint32_t, Shard>::iterator shard = shards.find(l->fileId());
+            if (shard != shards.end())
+                (shard->second.*member)[it->first].insert(*l);
+        }
+    }
+}
+
+template <typename T>
+static inline int locationsMemory(const T &map)
+{
+    int ret = 0;
+    for (typename T::const_iterator it = map.begin(); it != map.end(); ++it)
+        ret += sizeof(it->first) + it->second.size() * sizeof(Location);
+    return ret;
+}
+
+int SystemShard::memoryUsage() const
+{
+    int ret = symbols.size() * sizeof(SymbolMap::value_type);
+    for (SymbolMap::const_iterator it = symbols.begin(); it != symbols.end(); ++it)
+        ret += (it->second.targets.size() + it->second.references.size()) * sizeof(Location);
+    ret += locationsMemory(symbolNames) + locationsMemory(usrs) + locationsMemory(references);
+    for (SymbolNameMap::const_iterator it = symbolNames.begin(); it != symbolNames.end(); ++it)
+        ret += it->first.size();
+    return ret;
+}
+
+SystemIndex::SystemIndex(const String &key)
+    : mKey(key), mPath(Server::instance()->options().dataDir + "system/" + key)
+{
+}
+
+SystemIndex::~SystemIndex()
+{
+}
+
+String SystemIndex::key(const SourceInformation &source)
+{
+    if (source.compiler.isEmpty())
+        return String();
+    // only the flags that change what a system header expands to, include
+    // paths differ between projects but not where system headers live
+    static const char *flags[] = { "-D", "-U", "-std", "-m", "-f", "-nostd", "-stdlib", "--sysroot", 0 };
+    static const char *pairs[] = { "-isystem", "-include", "-target", "-x", 0 };
+    uint64_t hash = hashString(source.compiler);
+    for (int i=0; i<source.args.size(); ++i) {
+        const String &arg = source.args.at(i);
+        bool found = false;
+        for (int j=0; pairs[j] && !found; ++j) {
+            if (arg == pairs[j]) {
+                hash = hashString(arg, hash);
+                if (i + 1 < source.args.size())
+                    hash = hashString(source.args.at(++i), hash);
+                found = true;
+            }
+        }
+        for (int j=0; flags[j] && !found; ++j) {
+            if (arg.startsWith(flags[j])) {
+                hash = hashString(arg, hash);
+                found = true;
+            }
+        }
+    }
+    return String::format<32>("%016llx", static_cast<unsigned long long>(hash));
+}
+
+bool SystemIndex::restore()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mPath.isFile())
+        return false;
+    std::unique_ptr<DataFile> file(new DataFile(mPath));
+    if (!file->open(Server::DatabaseVersion)) {
+        error() << file->errorString() << "Removing.";
+        Path::rm(mPath);
+        return false;
+    }
+    // headers that changed while we weren't looking are indexed again
+    const time_t saved = mPath.lastModified();
+    const List<uint64_t> ids = file->sections();
+    for (List<uint64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+        const uint32_t fileId = static_cast<uint32_t>(*it);
+        if (Location::path(fileId).lastModified() <= saved) {
+            mFiles.insert(fileId);
+        } else {
+            mRemoved.insert(fileId);
+        }
+    }
+    mDataFile = std::move(file);
+    return true;
+}
+
+bool SystemIndex::isDirty() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return !mPending.isEmpty() || !mRemoved.isEmpty();
+}
+
+bool SystemIndex::save()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mPending.isEmpty() && mRemoved.isEmpty())
+        return true;
+    if (!Path::mkdir(mPath.parentDir())) {
+        error("Can't create directory [%s]", mPath.parentDir().constData());
+        return false;
+    }
+    DataFileWriter out(mPath);
+    if (!out.open(Server::DatabaseVersion))
+        return false;
+    if (mDataFile) {
+        const List<uint64_t> ids = mDataFile->sections();
+        for (List<uint64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it) {
+            if (!mRemoved.contains(static_cast<uint32_t>(*it)) && !out.copySection(*mDataFile, *it))
+                mFiles.remove(static_cast<uint32_t>(*it));
+        }
+    }
+    for (Hash<uint32_t, std::shared_ptr<const SystemShard> >::const_iterator it = mPending.begin(); it != mPending.end(); ++it) {
+        String data;
+        Serializer serializer(data);
+        const SystemShard &shard = *it->second;
+        serializer << shard.symbols << shard.symbolNames << shard.usrs << shard.references;
+        out.writeRaw(it->first, data.constData(), data.size());
+    }
+    if (!out.commit())
+        return false;
+    std::unique_ptr<DataFile> file(new DataFile(mPath));
+    if (!file->open(Server::DatabaseVersion)) {
+        error() << file->errorString();
+        return false;
+    }
+    mDataFile = std::move(file);
+    // projects keep using the ones they have, they're the same as what's on
+    // disk now
+    for (Hash<uint32_t, std::shared_ptr<const SystemShard> >::const_iterator it = mPending.begin(); it != mPending.end(); ++it)
+        mLoaded[it->first] = it->second;
+    mPending.clear();
+    mRemoved.clear();
+    return true;
+}
+
+bool SystemIndex::contains(uint32_t fileId) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFiles.contains(fileId);
+}
+
+int SystemIndex::count() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFiles.size();
+}
+
+// Moves the references made inside the header into the cursors they
+// reference so the shard can be queried on its own, and indexes the names.
+void SystemIndex::prepare(uint32_t fileId, SystemShard &shard)
+{
+    ReferenceMap::iterator it = shard.references.lower_bound(Location(fileId, 0));
+    const ReferenceMap::iterator end = shard.references.upper_bound(Location(fileId, UINT32_MAX));
+    while (it != end) {
+        for (Set<Location>::iterator target = it->second.begin(); target != it->second.end(); ) {
+            const SymbolMap::iterator cursor = target->fileId() == fileId ? shard.symbols.find(*target) : shard.symbols.end();
+            if (cursor != shard.symbols.end()) {
+                cursor->second.references.insert(it->first);
+                it->second.erase(target++);
+            } else {
+                ++target;
+            }
+        }
+        if (it->second.isEmpty()) {
+            shard.references.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    shard.names.reset(new SymbolNameIndex(shard.symbolNames));
+}
+
+void SystemIndex::add(const Set<uint32_t> &files, const IndexData &data)
+{
+    Set<uint32_t> added;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (Set<uint32_t>::const_iterator it = files.begin(); it != files.end(); ++it) {
+            if (!mFiles.contains(*it))
+                added.insert(*it);
+        }
+    }
+    if (added.isEmpty())
+        return;
+
+    Hash<uint32_t, SystemShard> shards;
+    for (Set<uint32_t>::const_iterator it = added.begin(); it != added.end(); ++it) {
+        SystemShard &shard = shards[*it];
+        shard.symbols.insert(data.symbols.lower_bound(Location(*it, 0)),
+                             data.symbols.upper_bound(Location(*it, UINT32_MAX)));
+        const IndexReferenceMap::const_iterator end = data.references.upper_bound(Location(*it, UINT32_MAX));
+        for (IndexReferenceMap::const_iterator ref = data.references.lower_bound(Location(*it, 0)); ref != end; ++ref)
+            shard.references[ref->first].insert(ref->second.begin(), ref->second.end());
+    }
+    splitLocations(data.symbolNames, &SystemShard::symbolNames, shards);
+    splitLocations(data.usrMap, &SystemShard::usrs, shards);
+
+    List<std::pair<uint32_t, std::shared_ptr<SystemShard> > > prepared;
+    for (Hash<uint32_t, SystemShard>::iterator it = shards.begin(); it != shards.end(); ++it) {
+        std::shared_ptr<SystemShard> shard(new SystemShard(std::move(it->second)));
+        prepare(it->first, *shard);
+        prepared.append(std::make_pair(it->first, shard));
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (int i=0; i<prepared.size(); ++i) {
+        const uint32_t fileId = prepared.at(i).first;
+        if (!mFiles.contains(fileId)) {
+            mFiles.insert(fileId);
+            mRemoved.remove(fileId);
+            mPending[fileId] = prepared.at(i).second;
+        }
+    }
+}
+
+std::shared_ptr<const SystemShard> SystemIndex::shard(uint32_t fileId) const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mFiles.contains(fileId))
+        return std::shared_ptr<const SystemShard>();
+    const Hash<uint32_t, std::shared_ptr<const SystemShard> >::const_iterator pending = mPending.find(fileId);
+    if (pending != mPending.end())
+        return pending->second;
+    std::weak_ptr<const SystemShard> &loaded = mLoaded[fileId];
+    std::shared_ptr<const SystemShard> ret = loaded.lock();
+    if (ret)
+        return ret;
+    uint64_t size;
+    const char *section = mDataFile ? mDataFile->section(fileId, &size) : 0;
+    if (!section) {
+        mLoaded.remove(fileId);
+        return ret;
+    }
+    std::shared_ptr<SystemShard> shard(new SystemShard);
+    Deserializer deserializer(section, static_cast<int>(size));
+    deserializer >> shard->symbols >> shard->symbolNames >> shard->usrs >> shard->references;
+    prepare(fileId, *shard);
+    loaded = shard;
+    return shard;
+}
+
+void SystemIndex::remove(uint32_t fileId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFiles.contains(fileId)) {
+        mFiles.remove(fileId);
+        mPending.remove(fileId);
+        mLoaded.remove(fileId);
+        mRemoved.insert(fileId);
+    }
+}
@@ -0,0 +1,94 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SystemIndex_h
+#define SystemIndex_h
+
+#include "RTags.h"
+#include "SymbolNameIndex.h"
+#include <rct/Hash.h>
+#include <rct/Path.h>
+#include <rct/Set.h>
+#include <rct/String.h>
+#include <memory>
+#include <mutex>
+
+class DataFile;
+class IndexData;
+class SourceInformation;
+
+// What the index knows about one header. The references made inside the
+// header are merged into its cursors, the ones into other headers are left
+// in references. Never changed once it's published, names points into
+// symbolNames.
+struct SystemShard
+{
+    SymbolMap symbols;
+    SymbolNameMap symbolNames;
+    UsrMap usrs;
+    ReferenceMap references;
+    std::unique_ptr<SymbolNameIndex> names;
+
+    int memoryUsage() const;
+};
+
+// Symbols in system headers come out the same for every project built with
+// the same compiler and flags. The first job that visits such a header
+// publishes what it found here and jobs in other projects pick it up
+// instead of visiting the header again.
+//
+// Projects don't copy the shards, they hold on to the ones for the headers
+// they include and look them up when they're queried. A shard is decoded
+// once and shared for as long as a project uses it.
+//
+// Each header is stored as one section keyed by its fileId in
+// dataDir/system/<key>, headers that haven't been saved yet are kept in
+// memory.
+class SystemIndex
+{
+public:
+    SystemIndex(const String &key);
+    ~SystemIndex();
+
+    static String key(const SourceInformation &source);
+    const String &key() const { return mKey; }
+    Path path() const { return mPath; }
+
+    bool restore();
+    bool save();
+    bool isDirty() const;
+
+    bool contains(uint32_t fileId) const;
+    int count() const;
+    // publishes the parts of data that belong to files that aren't in the
+    // index yet
+    void add(const Set<uint32_t> &files, const IndexData &data);
+    // what's stored for fileId, null if it isn't in the index
+    std::shared_ptr<const SystemShard> shard(uint32_t fileId) const;
+    void remove(uint32_t fileId);
+private:
+    static void prepare(uint32_t fileId, SystemShard &shard);
+
+    const String mKey;
+    const Path mPath;
+    mutable std::mutex mMutex;
+    std::unique_ptr<DataFile> mDataFile;
+    Set<uint32_t> mFiles, mRemoved;
+    Hash<uint32_t, std::shared_ptr<const SystemShard> > mPending;
+    // the saved ones projects are still using
+    mutable Hash<uint32_t, std::weak_ptr<const SystemShard> > mLoaded;
+};
+
+#endif
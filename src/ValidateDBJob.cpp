@@ -18,6 +18,7 @@ along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
 #include "RTags.h"
 #include "Server.h"
 #include "Project.h"
+#include "FileCache.h"
 #include <clang-c/Index.h>
 
 ValidateDBJob::ValidateDBJob(const std::shared_ptr<Project> &proj, const Set<Location> &prev)
@@ -32,12 +33,12 @@ void ValidateDBJob::execute()
     Set<Location> newErrors;
     {
         const SymbolMap &map = project()->symbols();
-        char *lastFileContents = 0;
+        std::shared_ptr<const FileContents> contents;
+        const char *lastFileContents = "";
         uint32_t lastFileId = -1;
         for (SymbolMap::const_iterator it = map.begin(); it != map.end(); ++it) {
             ++total;
             if (isAborted()) {
-                delete []lastFileContents;
                 return;
             }
             const CursorInfo &ci = it->second;
@@ -52,7 +53,7 @@ void ValidateDBJob::execute()
                     stream << " isDefinition: " << (ci.isDefinition() ? "true" : "false")
                            << " target: " << ci.targets
                            << " references:";
-                    for (Set<Location>::const_iterator rit = ci.references.begin(); rit != ci.references.end(); ++rit) {
+                    for (LocationSet::const_iterator rit = ci.references.begin(); rit != ci.references.end(); ++rit) {
                         stream << " " << *rit;
                     }
                 }
@@ -60,10 +61,12 @@ void ValidateDBJob::execute()
                 ++errors;
             } else if (it->second.kind != CXCursor_InclusionDirective) {
                 if (lastFileId != it->first.fileId()) {
-                    delete []lastFileContents;
                     lastFileId = it->first.fileId();
-                    Location::path(lastFileId).readAll(lastFileContents);
+                    contents = FileCache::contents(Location::path(lastFileId));
+                    lastFileContents = contents ? contents->contents().constData() : "";
                 }
+                if (!contents || it->first.offset() + it->second.symbolLength >= static_cast<uint32_t>(contents->contents().size()))
+                    continue;
                 int foundError = 0;
                 int offset = it->first.offset();
                 if (RTags::isOperator(lastFileContents[offset])) {
@@ -113,7 +116,6 @@ void ValidateDBJob::execute()
 
             }
         }
-        delete []lastFileContents;
     }
     mErrors(newErrors);
     error("Checked %d CursorInfo objects, %d errors", total, errors);
@@ -0,0 +1,91 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// Round-trips sets of locations through the varint encoding, checks that
+// they come back unchanged and compares the size with writing each location
+// as its 8 bytes.
+//
+// usage: locationbench [sets] [seed]
+//
+// The sets look like the targets and references of cursors, 1-20 locations
+// spread over 1-4 files, and some of them contain a null location.
+
+#include "Location.h"
+#include <rct/List.h>
+#include <rct/StopWatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static List<Set<Location> > generate(int count)
+{
+    List<Set<Location> > ret;
+    ret.reserve(count);
+    for (int i=0; i<count; ++i) {
+        Set<Location> locations;
+        const int files = 1 + rand() % 4;
+        const int size = 1 + rand() % 20;
+        uint32_t fileIds[4];
+        for (int f=0; f<files; ++f)
+            fileIds[f] = 1 + rand() % 20000;
+        while (locations.size() < size)
+            locations.insert(Location(fileIds[rand() % files], rand() % 200000));
+        if (!(i % 10))
+            locations.insert(Location());
+        ret.append(locations);
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    const int count = argc > 1 ? std::max(1, atoi(argv[1])) : 200000;
+    srand(argc > 2 ? atoi(argv[2]) : 1);
+    const List<Set<Location> > sets = generate(count);
+
+    StopWatch timer;
+    String encoded;
+    {
+        Serializer serializer(encoded);
+        for (int i=0; i<sets.size(); ++i)
+            serializer << sets.at(i);
+    }
+    const int encodeTime = timer.restart();
+
+    List<Set<Location> > decoded(sets.size());
+    {
+        Deserializer deserializer(encoded.constData(), encoded.size());
+        for (int i=0; i<decoded.size(); ++i)
+            deserializer >> decoded[i];
+    }
+    const int decodeTime = timer.elapsed();
+
+    uint64_t locations = 0;
+    int mismatches = 0;
+    for (int i=0; i<sets.size(); ++i) {
+        locations += sets.at(i).size();
+        if (sets.at(i) != decoded.at(i))
+            ++mismatches;
+    }
+    const uint64_t fixed = sets.size() * sizeof(int) + locations * sizeof(uint64_t);
+    printf("%d sets, %llu locations\n", sets.size(), static_cast<unsigned long long>(locations));
+    printf("fixed:  %.1fmb\n", fixed / (1024.0 * 1024.0));
+    printf("varint: %.1fmb (%.1f%%)\n", encoded.size() / (1024.0 * 1024.0), encoded.size() * 100.0 / fixed);
+    printf("encoded in %dms, decoded in %dms\n", encodeTime, decodeTime);
+    if (mismatches) {
+        fprintf(stderr, "%d sets didn't round-trip\n", mismatches);
+        return 1;
+    }
+    return 0;
+}
@@ -118,7 +118,9 @@ static void usage(FILE *f)
             "  --ignore-compiler|-b [arg]                 Alias this compiler (Might be practical to avoid duplicated builds for things like icecc).\n"
             "  --disable-plugin|-p [arg]                  Don't load this plugin\n"
             "  --disable-esprima|-E                       Don't use esprima\n"
-            "  --enable-compiler-flags|-K                 Query the compiler for default flags\n");
+            "  --enable-compiler-flags|-K                 Query the compiler for default flags\n"
+            "  --no-shared-system-index|-H                Don't share symbols from system headers between projects\n"
+            "  --skip-parsed-bodies|-B                    Index with clang's indexing API and parse the function bodies in headers only once. Bodies in system headers are not indexed.\n");
 }
 
 int main(int argc, char** argv)
@@ -160,6 +162,8 @@ int main(int argc, char** argv)
         { "watch-system-paths", no_argument, 0, 'w' },
         { "disable-esprima", no_argument, 0, 'E' },
         { "enable-compiler-flags", no_argument, 0, 'K' },
+        { "no-shared-system-index", no_argument, 0, 'H' },
+        { "skip-parsed-bodies", no_argument, 0, 'B' },
         { "clear-completion-cache-interval", required_argument, 0, 'O' },
 #ifdef OS_Darwin
         { "filemanager-watch", no_argument, 0, 'M' },
@@ -284,6 +288,12 @@ int main(int argc, char** argv)
         case 'E':
             serverOpts.options |= Server::NoEsprima;
             break;
+        case 'H':
+            serverOpts.options |= Server::NoSharedSystemIndex;
+            break;
+        case 'B':
+            serverOpts.options |= Server::SkipParsedBodies;
+            break;
         case 'm':
             serverOpts.options |= Server::AllowMultipleBuilds;
             break;
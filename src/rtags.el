@@ -278,6 +278,10 @@
                       ((looking-at "Project loading")
                        (erase-buffer)
                        (message "Project loading..."))
+                      ((re-search-forward "^Project loading, results may be incomplete\n?" nil t)
+                       (replace-match "")
+                       (goto-char (point-min))
+                       (message "Project loading, results may be incomplete"))
                       (t nil)))))
           (or async (> (point-max) (point-min))))))
     )
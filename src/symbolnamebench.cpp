@@ -0,0 +1,115 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// Compares the memory the symbol names of a project take up as one String
+// per cursor with SymbolName ids into the pool, and times interning and
+// reading them back from several threads.
+//
+// usage: symbolnamebench [file] [threads]
+//
+// Each line of file is the name of one cursor, e.g. the output of
+// rc --list-symbols repeated for every reference. Without a file a set of
+// qualified names where a few are used by most cursors is generated.
+
+#include "SymbolName.h"
+#include <rct/List.h>
+#include <rct/Path.h>
+#include <rct/StopWatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static List<String> generate()
+{
+    enum { Names = 50000, Cursors = 1000000 };
+    List<String> names;
+    names.reserve(Names);
+    for (int i=0; i<Names; ++i) {
+        names.append(String::format<128>("int ns%d::Class%d::method%d(const String &, int)",
+                                         i % 37, i % 1009, i));
+    }
+    List<String> ret;
+    ret.reserve(Cursors);
+    srand(1);
+    for (int i=0; i<Cursors; ++i) {
+        // squaring skews the draw towards the first names
+        const double r = static_cast<double>(rand()) / RAND_MAX;
+        ret.append(names.at(static_cast<int>(r * r * (Names - 1))));
+    }
+    return ret;
+}
+
+// what a String costs on the heap, short ones fit in the object itself
+static inline uint64_t stringMemory(const String &string)
+{
+    return sizeof(String) + (string.size() >= 16 ? string.size() + 1 : 0);
+}
+
+int main(int argc, char **argv)
+{
+    List<String> cursors;
+    if (argc > 1) {
+        const String contents = Path(argv[1]).readAll();
+        if (contents.isEmpty()) {
+            fprintf(stderr, "Can't read %s\n", argv[1]);
+            return 1;
+        }
+        cursors = contents.split('\n');
+    } else {
+        cursors = generate();
+    }
+    const int threadCount = argc > 2 ? std::max(1, atoi(argv[2])) : 4;
+
+    uint64_t strings = cursors.capacity() * sizeof(String);
+    for (int i=0; i<cursors.size(); ++i)
+        strings += stringMemory(cursors.at(i)) - sizeof(String);
+
+    StopWatch timer;
+    List<SymbolName> names(cursors.size());
+    std::vector<std::thread> threads;
+    for (int t=0; t<threadCount; ++t) {
+        threads.push_back(std::thread([t, threadCount, &cursors, &names]() {
+                    for (int i=t; i<cursors.size(); i += threadCount)
+                        names[i] = SymbolName(cursors.at(i));
+                }));
+    }
+    for (int t=0; t<threadCount; ++t)
+        threads[t].join();
+    const int internTime = timer.restart();
+
+    threads.clear();
+    std::atomic<uint64_t> bytes(0);
+    for (int t=0; t<threadCount; ++t) {
+        threads.push_back(std::thread([t, threadCount, &names, &bytes]() {
+                    uint64_t total = 0;
+                    for (int i=t; i<names.size(); i += threadCount)
+                        total += names.at(i).size();
+                    bytes += total;
+                }));
+    }
+    for (int t=0; t<threadCount; ++t)
+        threads[t].join();
+    const int readTime = timer.elapsed();
+
+    const uint64_t pooled = names.capacity() * sizeof(SymbolName) + SymbolName::memoryUsage();
+    printf("%d cursors, %d distinct names, %llu bytes of names\n", cursors.size(), SymbolName::count(),
+           static_cast<unsigned long long>(bytes.load()));
+    printf("String per cursor: %.1fmb\n", strings / (1024.0 * 1024.0));
+    printf("SymbolName pool:   %.1fmb (%.1f%%)\n", pooled / (1024.0 * 1024.0), pooled * 100.0 / strings);
+    printf("%d threads: interned in %dms, read in %dms\n", threadCount, internTime, readTime);
+    return 0;
+}
@@ -0,0 +1,43 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef Test_h
+#define Test_h
+
+#include <stdio.h>
+
+// Every test is its own program. CHECK() prints the conditions that don't
+// hold and main() returns testResult() so ctest sees the failure.
+static int sFailures = 0;
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++sFailures;                                                \
+        }                                                               \
+    } while (0)
+
+static inline int testResult(const char *name)
+{
+    if (sFailures) {
+        fprintf(stderr, "%s: %d checks failed\n", name, sFailures);
+        return 1;
+    }
+    printf("%s: passed\n", name);
+    return 0;
+}
+
+#endif
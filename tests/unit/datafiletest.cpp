@@ -0,0 +1,165 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// Writes DataFiles and damages them the way a crash or a bad disk would,
+// the sections that survive have to be readable and the others reported.
+
+#include "DataFile.h"
+#include "Test.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+enum { Version = 3 };
+
+static const Path sPath = String::format<64>("/tmp/datafiletest.%d", getpid());
+
+static void writeFile()
+{
+    DataFileWriter writer(sPath);
+    CHECK(writer.open(Version));
+    writer.writeRaw(1, "first section", 13);
+    List<String> strings;
+    strings.append("foo");
+    strings.append("bar");
+    writer.write(2, strings);
+    writer.writeRaw(3, "last section", 12);
+    CHECK(writer.commit());
+}
+
+static String contents()
+{
+    String ret;
+    if (FILE *f = fopen(sPath.constData(), "r")) {
+        char buf[1024];
+        size_t read;
+        while ((read = fread(buf, 1, sizeof(buf), f)))
+            ret.append(buf, read);
+        fclose(f);
+    }
+    return ret;
+}
+
+// flips a byte in the payload that starts with data
+static void corrupt(const char *data)
+{
+    const int pos = contents().indexOf(data);
+    CHECK(pos != -1);
+    if (FILE *f = fopen(sPath.constData(), "r+")) {
+        fseek(f, pos, SEEK_SET);
+        fputc(data[0] ^ 0xff, f);
+        fclose(f);
+    }
+}
+
+// cuts the file off in the middle of the payload that starts with data
+static void truncateAt(const char *data)
+{
+    const int pos = contents().indexOf(data);
+    CHECK(pos != -1);
+    CHECK(!truncate(sPath.constData(), pos + 4));
+}
+
+static void testReadWrite()
+{
+    writeFile();
+    DataFile file(sPath);
+    CHECK(file.open(Version));
+    CHECK(!file.isRecovered());
+    CHECK(file.sections().size() == 3);
+    uint64_t size;
+    const char *data = file.section(1, &size);
+    CHECK(data && size == 13 && !memcmp(data, "first section", 13));
+    List<String> strings;
+    CHECK(file.read(2, strings));
+    CHECK(strings.size() == 2 && strings.at(0) == "foo" && strings.at(1) == "bar");
+    CHECK(!file.hasSection(4));
+    CHECK(!file.section(4, &size));
+
+    DataFile wrongVersion(sPath);
+    CHECK(!wrongVersion.open(Version + 1));
+    CHECK(!wrongVersion.errorString().isEmpty());
+}
+
+static void testChecksum()
+{
+    writeFile();
+    corrupt("first section");
+    DataFile file(sPath);
+    CHECK(file.open(Version));
+    uint64_t size;
+    CHECK(!file.section(1, &size));
+    // the result is remembered
+    CHECK(!file.section(1, &size));
+    CHECK(file.section(3, &size) && size == 12);
+
+    const Path copy = sPath + ".copy";
+    {
+        DataFileWriter writer(copy);
+        CHECK(writer.open(Version));
+        CHECK(!writer.copySection(file, 1));
+        CHECK(writer.copySection(file, 3));
+        CHECK(writer.commit());
+    }
+    DataFile copied(copy);
+    CHECK(copied.open(Version));
+    CHECK(!copied.hasSection(1));
+    CHECK(copied.section(3, &size) && size == 12 && !memcmp(copied.section(3, &size), "last section", 12));
+    Path::rm(copy);
+}
+
+static void testRecovery()
+{
+    writeFile();
+    truncateAt("last section");
+    {
+        DataFile file(sPath);
+        CHECK(file.open(Version));
+        CHECK(file.isRecovered());
+        CHECK(file.damagedSections().isEmpty());
+        CHECK(file.hasSection(1) && file.hasSection(2));
+        // the torn write is dropped
+        CHECK(!file.hasSection(3));
+        List<String> strings;
+        CHECK(file.read(2, strings) && strings.size() == 2);
+    }
+
+    writeFile();
+    truncateAt("last section");
+    corrupt("first section");
+    {
+        DataFile file(sPath);
+        CHECK(file.open(Version));
+        CHECK(file.isRecovered());
+        CHECK(file.damagedSections().size() == 1 && file.damagedSections().at(0) == 1);
+        CHECK(!file.hasSection(1));
+        CHECK(file.hasSection(2));
+    }
+
+    // nothing left to recover
+    writeFile();
+    truncateAt("first section");
+    DataFile file(sPath);
+    CHECK(!file.open(Version));
+}
+
+int main()
+{
+    testReadWrite();
+    testChecksum();
+    testRecovery();
+    Path::rm(sPath);
+    return testResult("datafiletest");
+}
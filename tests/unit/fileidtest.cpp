@@ -0,0 +1,96 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// The fileId <-> path table, see InternTable.h.
+
+#include "Location.h"
+#include "Test.h"
+#include <thread>
+#include <vector>
+
+static Path path(int i)
+{
+    return String::format<64>("/tmp/fileidtest/dir%d/file%d.cpp", i % 17, i);
+}
+
+static void testLookups()
+{
+    const uint32_t a = Location::insertFile(path(0));
+    const uint32_t b = Location::insertFile(path(1));
+    CHECK(a && b && a != b);
+    CHECK(Location::insertFile(path(0)) == a);
+    CHECK(Location::fileId(path(1)) == b);
+    CHECK(Location::path(a) == path(0));
+    CHECK(!Location::fileId("/tmp/fileidtest/missing.cpp"));
+    CHECK(Location::path(0).isEmpty());
+    CHECK(Location::path(b + 1000).isEmpty());
+}
+
+static void testThreads()
+{
+    // the table grows several times while the threads insert and look up
+    // the same paths in different orders
+    enum { Paths = 20000, Threads = 4 };
+    std::vector<std::vector<uint32_t> > ids(Threads, std::vector<uint32_t>(Paths));
+    std::vector<std::thread> threads;
+    for (int t=0; t<Threads; ++t) {
+        threads.push_back(std::thread([t, &ids]() {
+                    for (int i=0; i<Paths; ++i) {
+                        const int idx = (i * 7919 + t * 104729) % Paths;
+                        ids[t][idx] = Location::insertFile(path(idx + 2));
+                    }
+                }));
+    }
+    for (size_t i=0; i<threads.size(); ++i)
+        threads[i].join();
+
+    int mismatches = 0;
+    for (int i=0; i<Paths; ++i) {
+        for (int t=1; t<Threads; ++t) {
+            if (ids[t][i] != ids[0][i])
+                ++mismatches;
+        }
+        if (Location::path(ids[0][i]) != path(i + 2) || Location::fileId(path(i + 2)) != ids[0][i])
+            ++mismatches;
+    }
+    CHECK(!mismatches);
+    CHECK(Location::fileCount() == Paths + 2);
+    uint32_t lastId;
+    CHECK(Location::pathsSince(0, &lastId).size() == Paths + 2);
+    CHECK(lastId == Paths + 2);
+}
+
+static void testInit()
+{
+    // what restoring the fileIds of a database does
+    Hash<Path, uint32_t> pathsToIds;
+    pathsToIds["/tmp/fileidtest/a.cpp"] = 5;
+    pathsToIds["/tmp/fileidtest/b.cpp"] = 9;
+    Location::init(pathsToIds);
+    CHECK(Location::fileId("/tmp/fileidtest/a.cpp") == 5);
+    CHECK(Location::path(9) == "/tmp/fileidtest/b.cpp");
+    CHECK(!Location::fileId(path(0)));
+    CHECK(Location::path(1).isEmpty());
+    CHECK(Location::insertFile("/tmp/fileidtest/c.cpp") == 10);
+    CHECK(Location::idsToPaths().size() == 3);
+}
+
+int main()
+{
+    testLookups();
+    testThreads();
+    testInit();
+    return testResult("fileidtest");
+}
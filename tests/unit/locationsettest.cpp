@@ -0,0 +1,175 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// LocationSet keeps two locations inline and moves to the heap after that.
+
+#include "LocationSet.h"
+#include "Test.h"
+#include <stdlib.h>
+#include <utility>
+
+static bool same(const LocationSet &locations, const Set<Location> &expected)
+{
+    return locations.size() == expected.size() && std::equal(locations.begin(), locations.end(), expected.begin());
+}
+
+static void testInlineToHeap()
+{
+    LocationSet locations;
+    CHECK(locations.isEmpty());
+    CHECK(!locations.memoryUsage());
+    CHECK(locations.insert(Location(1, 20)));
+    CHECK(locations.insert(Location(1, 10)));
+    CHECK(!locations.insert(Location(1, 10)));
+    CHECK(!locations.memoryUsage());
+
+    CHECK(locations.insert(Location(2, 5)));
+    CHECK(locations.memoryUsage());
+    Set<Location> expected;
+    expected.insert(Location(1, 20));
+    expected.insert(Location(1, 10));
+    expected.insert(Location(2, 5));
+    CHECK(same(locations, expected));
+
+    // removing doesn't go back inline, clearing does
+    CHECK(locations.remove(Location(2, 5)));
+    CHECK(!locations.remove(Location(2, 5)));
+    CHECK(locations.size() == 2);
+    locations.clear();
+    CHECK(locations.isEmpty());
+    CHECK(!locations.memoryUsage());
+}
+
+static void testCopyAndMove()
+{
+    LocationSet small, large;
+    small.insert(Location(3, 1));
+    for (uint32_t i=0; i<10; ++i)
+        large.insert(Location(4, i));
+
+    LocationSet copy(large);
+    CHECK(copy == large);
+    copy.remove(Location(4, 0));
+    CHECK(copy != large);
+    CHECK(large.size() == 10);
+
+    LocationSet moved(std::move(large));
+    CHECK(moved.size() == 10 && moved.memoryUsage());
+    CHECK(large.isEmpty() && !large.memoryUsage());
+
+    moved = std::move(small);
+    CHECK(moved.size() == 1 && !moved.memoryUsage());
+    CHECK(moved.contains(Location(3, 1)));
+    CHECK(small.isEmpty());
+
+    moved = copy;
+    CHECK(moved == copy);
+}
+
+static void testUnite()
+{
+    LocationSet a, b;
+    a.insert(Location(1, 1));
+    b.insert(Location(1, 2));
+    int added;
+    a.unite(b, &added);
+    CHECK(added == 1 && a.size() == 2 && !a.memoryUsage());
+
+    b.clear();
+    b.insert(Location(1, 1));
+    b.insert(Location(1, 3));
+    a.unite(b, &added);
+    CHECK(added == 1 && a.size() == 3 && a.memoryUsage());
+    a.unite(b, &added);
+    CHECK(!added && a.size() == 3);
+    CHECK(a.first() == Location(1, 1) && a.last() == Location(1, 3));
+}
+
+static void testAgainstSet()
+{
+    // random operations on both, they have to end up with the same contents
+    srand(1);
+    for (int round=0; round<200; ++round) {
+        LocationSet locations;
+        Set<Location> expected;
+        for (int i=0; i<50; ++i) {
+            const Location location(rand() % 3, rand() % 20);
+            switch (rand() % 4) {
+            case 0:
+            case 1:
+                CHECK(locations.insert(location) == expected.insert(location));
+                break;
+            case 2:
+                CHECK(locations.remove(location) == (expected.erase(location) > 0));
+                break;
+            case 3: {
+                LocationSet other;
+                for (int j=rand() % 4; j>0; --j) {
+                    const Location l(rand() % 3, rand() % 20);
+                    other.insert(l);
+                    expected.insert(l);
+                }
+                locations.unite(other);
+                break; }
+            }
+        }
+        CHECK(same(locations, expected));
+
+        const uint32_t fileId = rand() % 3;
+        locations.removeIf([fileId](const Location &l) { return l.fileId() == fileId; });
+        for (Set<Location>::iterator it = expected.begin(); it != expected.end(); ) {
+            if (it->fileId() == fileId) {
+                expected.erase(it++);
+            } else {
+                ++it;
+            }
+        }
+        CHECK(same(locations, expected));
+    }
+}
+
+static void testSerialization()
+{
+    // same bytes as a Set<Location>
+    for (int size=0; size<6; ++size) {
+        LocationSet locations;
+        Set<Location> expected;
+        for (int i=0; i<size; ++i) {
+            locations.insert(Location(i % 2, i * 100));
+            expected.insert(Location(i % 2, i * 100));
+        }
+        String a, b;
+        {
+            Serializer sa(a), sb(b);
+            sa << locations;
+            sb << expected;
+        }
+        CHECK(a == b);
+        LocationSet decoded;
+        Deserializer deserializer(a.constData(), a.size());
+        deserializer >> decoded;
+        CHECK(decoded == locations);
+    }
+}
+
+int main()
+{
+    testInlineToHeap();
+    testCopyAndMove();
+    testUnite();
+    testAgainstSet();
+    testSerialization();
+    return testResult("locationsettest");
+}
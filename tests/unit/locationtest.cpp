@@ -0,0 +1,107 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// The varint encoding of location sets, see writeLocations() in Location.h.
+
+#include "Location.h"
+#include "Test.h"
+#include <stdlib.h>
+
+static String encode(const Set<Location> &locations)
+{
+    String out;
+    {
+        Serializer serializer(out);
+        serializer << locations;
+    }
+    return out;
+}
+
+static Set<Location> decode(const String &data)
+{
+    Set<Location> locations;
+    Deserializer deserializer(data.constData(), data.size());
+    deserializer >> locations;
+    return locations;
+}
+
+static void testLayout()
+{
+    // count, fileId + 1, offset, 0 for the same file, offset delta
+    Set<Location> locations;
+    locations.insert(Location(3, 10));
+    locations.insert(Location(3, 12));
+    CHECK(encode(locations) == String("\x02\x04\x0a\x00\x02", 5));
+
+    // 300 takes two bytes
+    locations.clear();
+    locations.insert(Location(1, 300));
+    CHECK(encode(locations) == String("\x01\x02\xac\x02", 4));
+
+    CHECK(encode(Set<Location>()) == String("\x00", 1));
+}
+
+static void testNull()
+{
+    // fileId 0 is written as 1, it mustn't be taken for "same file"
+    Set<Location> locations;
+    locations.insert(Location());
+    CHECK(encode(locations) == String("\x01\x01\x00", 3));
+    CHECK(decode(encode(locations)) == locations);
+
+    locations.insert(Location(2, 7));
+    const uint32_t noFile = 0;
+    locations.insert(Location(noFile, 5));
+    const Set<Location> decoded = decode(encode(locations));
+    CHECK(decoded == locations);
+    CHECK(decoded.contains(Location()));
+    CHECK(decoded.contains(Location(noFile, 5)));
+}
+
+static void testRoundTrip()
+{
+    srand(1);
+    List<Set<Location> > sets;
+    String encoded;
+    {
+        Serializer serializer(encoded);
+        for (int i=0; i<1000; ++i) {
+            Set<Location> locations;
+            const int size = rand() % 20;
+            for (int j=0; j<size; ++j) {
+                // large offsets need all five bytes, fileIds stay below 1 << 28
+                const uint32_t fileId = rand() % 3 ? rand() % 8 : rand() % (1 << 28);
+                const uint32_t offset = rand() % 2 ? rand() % 1000 : static_cast<uint32_t>(rand()) << 4;
+                locations.insert(Location(fileId, offset));
+            }
+            sets.append(locations);
+            serializer << locations;
+        }
+    }
+    Deserializer deserializer(encoded.constData(), encoded.size());
+    for (int i=0; i<sets.size(); ++i) {
+        Set<Location> locations;
+        deserializer >> locations;
+        CHECK(locations == sets.at(i));
+    }
+}
+
+int main()
+{
+    testLayout();
+    testNull();
+    testRoundTrip();
+    return testResult("locationtest");
+}
@@ -0,0 +1,154 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// Prefix lookups in SymbolNameIndex, and a random mix of inserts and
+// removals that has to end up like an index built from the map.
+
+#include "SymbolNameIndex.h"
+#include "Test.h"
+#include <stdlib.h>
+
+static String key(const char *type, const char *name, bool parameter = false)
+{
+    return SymbolNameIndex::key(type, name, strlen(name), parameter);
+}
+
+static List<String> lookup(const SymbolNameIndex &index, const String &prefix)
+{
+    List<String> ret;
+    for (SymbolNameIndex::const_iterator it = index.lowerBound(prefix);
+         it != index.end() && SymbolNameIndex::startsWith(it, prefix); ++it) {
+        ret.append(SymbolNameIndex::name(it));
+    }
+    return ret;
+}
+
+static List<String> names(const SymbolNameIndex &index)
+{
+    List<String> ret;
+    for (SymbolNameIndex::const_iterator it = index.begin(); it != index.end(); ++it)
+        ret.append(SymbolNameIndex::name(it));
+    return ret;
+}
+
+static void testLookup()
+{
+    SymbolNameMap map;
+    map[key("int ", "ns::Foo::bar")].insert(Location(1, 10));
+    map[key("int ", "ns::foo(int)::arg", true)].insert(Location(1, 20));
+    map[key("", "ns::Foo")].insert(Location(1, 5));
+    const SymbolNameIndex index(map);
+
+    List<String> found = lookup(index, "bar");
+    CHECK(found.size() == 1 && found.at(0) == "bar");
+    found = lookup(index, "Foo::");
+    CHECK(found.size() == 1 && found.at(0) == "Foo::bar");
+    found = lookup(index, "ns::Foo");
+    CHECK(found.size() == 2 && found.at(0) == "ns::Foo" && found.at(1) == "ns::Foo::bar");
+    CHECK(lookup(index, "int bar").size() == 1);
+    CHECK(lookup(index, "int ns::Foo::bar").size() == 1);
+    CHECK(lookup(index, "Foo::baz").isEmpty());
+
+    // a parameter's type only goes with the names that don't contain the function
+    CHECK(lookup(index, "arg").size() == 1);
+    CHECK(lookup(index, "int arg").size() == 1);
+    CHECK(lookup(index, "foo(int)::arg").size() == 1);
+    CHECK(lookup(index, "int foo(int)::arg").isEmpty());
+    CHECK(lookup(index, "int ns::foo(int)::arg").isEmpty());
+
+    SymbolNameIndex::const_iterator it = index.lowerBound("bar");
+    CHECK(it != index.end() && SymbolNameIndex::locations(it).contains(Location(1, 10)));
+}
+
+static void testUpdate()
+{
+    SymbolNameMap map;
+    map[key("", "a::b")].insert(Location(1, 1));
+    SymbolNameIndex index(map);
+
+    SymbolNameMap::iterator added = map.insert(std::make_pair(key("", "a::c"), Set<Location>())).first;
+    index.insert(added);
+    CHECK(lookup(index, "c").isEmpty());
+    index.commit();
+    CHECK(lookup(index, "c").size() == 1);
+    CHECK(lookup(index, "a::").size() == 2);
+
+    index.remove(map.find(key("", "a::b")));
+    map.erase(key("", "a::b"));
+    CHECK(lookup(index, "b").isEmpty());
+    CHECK(lookup(index, "a::").size() == 1);
+
+    index.remove(added);
+    map.erase(added);
+    CHECK(names(index).isEmpty());
+    CHECK(!index.count());
+}
+
+static String randomKey()
+{
+    String ret;
+    if (rand() % 2)
+        ret = key("int ", "", rand() % 2);
+    const int scopes = 1 + rand() % 4;
+    for (int i=0; i<scopes; ++i) {
+        if (i)
+            ret += "::";
+        ret += String::format<16>("n%d", rand() % 300);
+        if (rand() % 8 == 0)
+            ret += "(int)";
+    }
+    return ret;
+}
+
+static void testRandom()
+{
+    srand(1);
+    SymbolNameMap map;
+    for (int i=0; i<5000; ++i)
+        map[randomKey()].insert(Location(1, i));
+    SymbolNameIndex index(map);
+
+    // enough changes to go through several merges
+    for (int round=0; round<20000; ++round) {
+        if (rand() % 2) {
+            const std::pair<SymbolNameMap::iterator, bool> inserted = map.insert(std::make_pair(randomKey(), Set<Location>()));
+            if (inserted.second)
+                index.insert(inserted.first);
+            if (rand() % 8 == 0)
+                index.commit();
+        } else if (!map.isEmpty()) {
+            SymbolNameMap::iterator it = map.begin();
+            std::advance(it, rand() % map.size());
+            index.remove(it);
+            map.erase(it);
+        }
+        if (round % 2000 == 0) {
+            index.commit();
+            const SymbolNameIndex fresh(map);
+            CHECK(index.count() == fresh.count());
+            CHECK(names(index) == names(fresh));
+            const String prefix = String::format<16>("n%d", rand() % 300);
+            CHECK(lookup(index, prefix) == lookup(fresh, prefix));
+        }
+    }
+}
+
+int main()
+{
+    testLookup();
+    testUpdate();
+    testRandom();
+    return testResult("symbolnameindextest");
+}
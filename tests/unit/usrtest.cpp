@@ -0,0 +1,74 @@
+/* This file is part of RTags.
+
+RTags is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RTags is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+// UsrMap is keyed by a hash of the USR, cursors that share a hash are only
+// joined when CursorInfo::isSameEntity() says so.
+
+#include "CursorInfo.h"
+#include "RTags.h"
+#include "Test.h"
+
+static CursorInfo cursor(const char *name, CXCursorKind kind)
+{
+    CursorInfo ret;
+    ret.symbolName = name;
+    ret.kind = kind;
+    return ret;
+}
+
+static void testHash()
+{
+    CHECK(!RTags::usrHash(0));
+    CHECK(!RTags::usrHash(""));
+    CHECK(RTags::usrHash("c:@N@ns@S@Foo") == RTags::usrHash(String("c:@N@ns@S@Foo").constData()));
+    CHECK(RTags::usrHash("c:@N@ns@S@Foo") != RTags::usrHash("c:@N@ns@S@Bar"));
+
+    // the USRs of one file's overloads and members mustn't collide
+    Set<uint64_t> hashes;
+    int count = 0;
+    for (int i=0; i<1000; ++i) {
+        const String usr = String::format<64>("c:@N@ns@S@Foo@F@method%d#I#", i);
+        const uint64_t hash = RTags::usrHash(usr.constData());
+        CHECK(hash);
+        hashes.insert(hash);
+        ++count;
+        hashes.insert(RTags::usrHash(String::format<64>("c:@N@ns@S@Foo@FI@member%d", i).constData()));
+        ++count;
+    }
+    CHECK(hashes.size() == count);
+}
+
+static void testSameEntity()
+{
+    const CursorInfo classFoo = cursor("ns::Foo", CXCursor_ClassDecl);
+    CHECK(classFoo.isSameEntity(cursor("ns::Foo", CXCursor_ClassDecl)));
+    // forward declared as a struct
+    CHECK(classFoo.isSameEntity(cursor("ns::Foo", CXCursor_StructDecl)));
+    CHECK(cursor("ns::Foo", CXCursor_StructDecl).isSameEntity(classFoo));
+
+    // what a collision between two hashes would look like
+    CHECK(!classFoo.isSameEntity(cursor("ns::Bar", CXCursor_ClassDecl)));
+    CHECK(!classFoo.isSameEntity(cursor("ns::Foo", CXCursor_FunctionDecl)));
+    CHECK(!classFoo.isSameEntity(cursor("ns::Foo", CXCursor_ClassTemplate)));
+    CHECK(!cursor("int foo()", CXCursor_FunctionDecl).isSameEntity(cursor("int foo()", CXCursor_VarDecl)));
+    CHECK(cursor("int foo()", CXCursor_FunctionDecl).isSameEntity(cursor("int foo()", CXCursor_FunctionDecl)));
+}
+
+int main()
+{
+    testHash();
+    testSameEntity();
+    return testResult("usrtest");
+}